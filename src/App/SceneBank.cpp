@@ -24,12 +24,21 @@
 #include "EntryScene.h"
 #include "EntryFile.h"
 #include "ElnAssert.h"
+#include <QTimer>
+
+#define PREFETCH_DELAY_MS 300
 
 SceneBank::SceneBank(Notebook *nb): nb(nb) {
   frontScene_ = new FrontScene(nb, this);
 
   tocScene_ = new TOCScene(nb->toc(), this);
   tocScene_->populate();
+
+  maxRetained = 5;
+  prefetchTimer = new QTimer(this);
+  prefetchTimer->setSingleShot(true);
+  connect(prefetchTimer, SIGNAL(timeout()), SLOT(prefetch()));
+  connect(nb, SIGNAL(entryLoaded(int)), SLOT(prefetch()));
 }
 
 SceneBank::~SceneBank() {
@@ -45,10 +54,77 @@ FrontScene *SceneBank::frontScene() {
 }
 
 CachedPointer<EntryScene> SceneBank::entryScene(int startPage) {
+  CachedPointer<EntryScene> ptr(findOrBuild(startPage));
+  retain(startPage, ptr);
+
+  // Get ready for the user to turn the page
+  prefetchQueue.clear();
+  TOCEntry *te = nb->toc()->tocEntry(startPage);
+  TOCEntry *nextte = nb->toc()->entryAfter(te);
+  if (nextte)
+    prefetchQueue << nextte->startPage();
+  TOCEntry *prevte = startPage>1 ? nb->toc()->findBackward(startPage-1) : 0;
+  if (prevte)
+    prefetchQueue << prevte->startPage();
+  prefetchTimer->start(PREFETCH_DELAY_MS);
+
+  return ptr;
+}
+
+void SceneBank::prefetch() {
+  /* We build only one scene at a time, so as not to hold up the user
+     for longer than necessary. The entry itself is loaded in the
+     background; we are called again when it is ready. */
+  while (!prefetchQueue.isEmpty()) {
+    int startPage = prefetchQueue.first();
+    if (!nb->toc()->contains(startPage)) {
+      prefetchQueue.removeFirst();
+      continue;
+    }
+    if (!nb->entryAsync(startPage))
+      return;
+    prefetchQueue.removeFirst();
+    if (entryScenes.contains(startPage) && entryScenes[startPage].obj()) {
+      retain(startPage, entryScenes[startPage]);
+      continue;
+    }
+    retain(startPage, findOrBuild(startPage));
+    break;
+  }
+  if (!prefetchQueue.isEmpty())
+    prefetchTimer->start(PREFETCH_DELAY_MS);
+}
+
+void SceneBank::setRetention(int maxScenes) {
+  maxRetained = maxScenes;
+  while (retainedOrder.size() > maxRetained)
+    retained.remove(retainedOrder.takeLast());
+}
+
+void SceneBank::retain(int startPage, CachedPointer<EntryScene> const &ptr) {
+  retainedOrder.removeOne(startPage);
+  retainedOrder.prepend(startPage);
+  retained[startPage] = ptr;
+  while (retainedOrder.size() > maxRetained)
+    retained.remove(retainedOrder.takeLast());
+}
+
+void SceneBank::dropEntryScene(int startPage) {
+  prefetchQueue.removeAll(startPage);
+  retainedOrder.removeOne(startPage);
+  retained.remove(startPage);
+}
+
+CachedPointer<EntryScene> SceneBank::findOrBuild(int startPage) {
   if (entryScenes.contains(startPage)) {
     CachedPointer<EntryScene> ptr(entryScenes[startPage]);
-    if (ptr)
+    if (ptr) {
+      // The entry that follows may have changed since we built this
+      TOCEntry *nextte
+        = nb->toc()->entryAfter(nb->toc()->tocEntry(startPage));
+      ptr->clipPgNoAt(nextte ? nextte->startPage() : 0);
       return ptr;
+    }
   }
 
   // No cached copy, or deleted cached copy
@@ -25,6 +25,7 @@
 #include <QMap>
 
 class SceneBank: public QObject {
+  Q_OBJECT;
 public:
   SceneBank(class Notebook *nb);
   ~SceneBank();
@@ -32,11 +33,27 @@ public:
   class TOCScene *tocScene();
   class FrontScene *frontScene();
   CachedPointer<class EntryScene> entryScene(int startPage);
+  /* Scenes are kept for a while after their last user lets go. Once an
+     entry has been asked for, its neighbors are built in the background
+     as well, so that paging through the book is instantaneous. */
+  void dropEntryScene(int startPage);
+  /* Must be called before an entry is deleted. */
+  void setRetention(int maxScenes);
+private slots:
+  void prefetch();
+private:
+  CachedPointer<EntryScene> findOrBuild(int startPage);
+  void retain(int startPage, CachedPointer<EntryScene> const &);
 private:
   Notebook *nb;
   FrontScene *frontScene_;
   TOCScene *tocScene_;
   QMap<int, CachedPointer<EntryScene> > entryScenes;
+  QMap<int, CachedPointer<EntryScene> > retained;
+  QList<int> retainedOrder; // most recently used first
+  int maxRetained;
+  QList<int> prefetchQueue;
+  class QTimer *prefetchTimer;
 };
 
 #endif
@@ -35,6 +35,8 @@
 #include "CrashReport.h"
 #include "VersionControl.h"
 #include "CUI.h"
+#include "EntryFile.h"
+#include "SaveScheduler.h"
 
 int main(int argc, char **argv) {
   CrashReport cr;
@@ -53,6 +55,16 @@ int main(int argc, char **argv) {
       argc--;
       argv++;
     }
+    if (argc>1 && QString("-journal")==argv[1]) {
+      setEntryJournaling(true);
+      argc--;
+      argv++;
+    }
+    if (argc>1 && QString("-savestats")==argv[1]) {
+      SaveScheduler::instance()->setLogging(true);
+      argc--;
+      argv++;
+    }
 
     if (argc==1) {
       nb = SplashScene::openNotebook();
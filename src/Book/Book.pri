@@ -3,8 +3,11 @@
 HEADERS += \
      Book/BookData.h  \
      Book/Catalog.h  \
+     Book/EntryScanner.h  \
      Book/Index.h  \
+     Book/MetaIndex.h  \
      Book/Notebook.h  \
+     Book/PhraseIndex.h  \
      Book/Search.h  \
      Book/SearchResult.h  \
      Book/Style.h  \
@@ -16,8 +19,11 @@ HEADERS += \
 SOURCES += \
      Book/BookData.cpp  \
      Book/Catalog.cpp  \
+     Book/EntryScanner.cpp  \
      Book/Index.cpp  \
+     Book/MetaIndex.cpp  \
      Book/Notebook.cpp  \
+     Book/PhraseIndex.cpp  \
      Book/Search.cpp  \
      Book/Style.cpp  \
      Book/TOC.cpp  \
@@ -1,49 +1,172 @@
 // Catalog.cpp
 
 #include "Catalog.h"
+#include "FileWriter.h"
 #include <QDir>
+#include <QDirIterator>
 #include <QFileInfo>
 #include <QRegExp>
+#include <QDataStream>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <string.h>
 
-Catalog::Catalog(QString pgdir): pgdir(pgdir) {
+/* The snapshot file consists of a magic "ELNCATL" followed by a zero
+   byte, a u32 version (1), and a QDataStream (Qt 5.0 format) containing
+     qint32 nFiles
+     nFiles times:
+       QString name, qint32 page, qint64 size, QDateTime mod,
+       QByteArray md5 (empty if not known)
+   Content hashes are only computed for files that changed since the
+   previous snapshot, so that taking the first one is as cheap as an
+   ordinary catalog.
+*/
+
+static char const snapshotMagic[8] = { 'E','L','N','C','A','T','L',0 };
+static quint32 const snapshotVersion = 1;
+
+static bool indicatesFailedUpdate(QString fn) {
+  return fn.endsWith(".moved") || fn.endsWith(".THIS")
+    || fn.endsWith(".OTHER") || fn.endsWith(".BASE");
+}
+
+Catalog::Catalog(QString pgdir, QString snapshot): pgdir(pgdir) {
   ok = false;
+  incremental = false;
+  differs = true;
   QDir pages(pgdir);
   if (!pages.exists())
     return;
 
+  QMap<QString, FileInfo> old;
+  if (!snapshot.isEmpty())
+    incremental = loadSnapshot(snapshot, old);
+  differs = !incremental;
+  
   QRegExp re1("^(\\d\\d*)-([a-z0-9]+).json");
   QRegExp re0("^(\\d\\d*).json");
   QRegExp ren("^(\\d\\d*)-([a-z0-9]+).notes");
   
-  foreach (QFileInfo const &fi, pages.entryInfoList()) {
+  QDirIterator it(pgdir, QDir::AllEntries | QDir::NoDotAndDotDot);
+  while (it.hasNext()) {
+    it.next();
+    QFileInfo fi = it.fileInfo();
+    QString fn = fi.fileName();
     if (fi.isFile()) {
-      QString fn = fi.fileName();
-      if (fn.endsWith(".moved") || fn.endsWith(".THIS")
-          || fn.endsWith(".OTHER") || fn.endsWith(".BASE")) 
+      if (indicatesFailedUpdate(fn))
         err << "Presence of " + fn + " indicates unsuccessful bzr update.";
       if (!fn.endsWith(".json"))
         continue;
-      if (re1.exactMatch(fn)) {
-        int n = re1.cap(1).toInt();
-        pg2file.insert(n, fn);
-        filemods[fn] = fi.lastModified();
-      } else if (re0.exactMatch(fn)) {
-        int n = re0.cap(1).toInt();
-        pg2file.insert(n, fn);
-        filemods[fn] = fi.lastModified();
+      FileInfo info;
+      info.size = fi.size();
+      info.mod = fi.lastModified();
+      auto o = old.find(fn);
+      if (o!=old.end()) {
+        // Known name, so no need to parse it again
+        info.page = o.value().page;
+        if (info.size==o.value().size && info.mod==o.value().mod) {
+          info.hash = o.value().hash;
+        } else {
+          differs = true;
+          info.hash = contentHash(fi.absoluteFilePath());
+          if (info.hash.isEmpty() || info.hash!=o.value().hash)
+            changed << info.page;
+        }
+        old.erase(o);
       } else {
-        err << "Cannot parse " + fn + " as a page file name.";
+        if (re1.exactMatch(fn)) {
+          info.page = re1.cap(1).toInt();
+        } else if (re0.exactMatch(fn)) {
+          info.page = re0.cap(1).toInt();
+        } else {
+          err << "Cannot parse " + fn + " as a page file name.";
+          continue;
+        }
+        if (incremental) {
+          differs = true;
+          info.hash = contentHash(fi.absoluteFilePath());
+          changed << info.page;
+        }
       }
+      files[fn] = info;
+      pg2file.insert(info.page, fn);
+      filemods[fn] = info.mod;
     } else if (fi.isDir()) {
-      QString fn = fi.fileName();
-      if (fn.endsWith(".moved") || fn.endsWith(".THIS")
-          || fn.endsWith(".OTHER") || fn.endsWith(".BASE")) 
+      if (indicatesFailedUpdate(fn))
         err << "Presence of " + fn + " indicates unsuccessful bzr update.";
       if (ren.exactMatch(fn)) {
         notemods[fn] = fi.lastModified();
       }
     }
-  }  
+  }
+  // Whatever is left of the snapshot has been removed
+  for (FileInfo const &info: old) {
+    changed << info.page;
+    differs = true;
+  }
+  ok = true;
+}
+
+bool Catalog::loadSnapshot(QString fn, QMap<QString, FileInfo> &dst) {
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly))
+    return false;
+  QByteArray data = f.readAll();
+  f.close();
+  if (data.size()<12 || memcmp(data.constData(), snapshotMagic, 8)!=0) {
+    qDebug() << "Catalog: Not a snapshot" << fn;
+    return false;
+  }
+  QDataStream s(data.mid(8));
+  s.setVersion(QDataStream::Qt_5_0);
+  quint32 version = 0;
+  qint32 n = 0;
+  s >> version;
+  if (version!=snapshotVersion) {
+    qDebug() << "Catalog: Unknown snapshot version" << version;
+    return false;
+  }
+  s >> n;
+  for (int k=0; k<n && s.status()==QDataStream::Ok; k++) {
+    QString name;
+    FileInfo info;
+    qint32 page;
+    s >> name >> page >> info.size >> info.mod >> info.hash;
+    info.page = page;
+    dst[name] = info;
+  }
+  if (s.status()!=QDataStream::Ok) {
+    qDebug() << "Catalog: Corrupt snapshot" << fn;
+    dst.clear();
+    return false;
+  }
+  return true;
+}
+
+bool Catalog::saveSnapshot(QString fn) const {
+  if (!ok)
+    return false;
+  if (!differs)
+    return true;
+  QByteArray data(snapshotMagic, 8);
+  QDataStream s(&data, QIODevice::WriteOnly | QIODevice::Append);
+  s.setVersion(QDataStream::Qt_5_0);
+  s << snapshotVersion << qint32(files.size());
+  for (auto it=files.begin(); it!=files.end(); ++it)
+    s << it.key() << qint32(it.value().page) << it.value().size
+      << it.value().mod << it.value().hash;
+  FileWriter::instance()->write(fn, data, FileWriter::ReplaceBinary);
+  return true;
+}
+
+QByteArray Catalog::contentHash(QString fn) {
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly))
+    return QByteArray();
+  QCryptographicHash h(QCryptographicHash::Md5);
+  if (!h.addData(&f))
+    return QByteArray();
+  return h.result();
 }
 
 bool Catalog::isClean() const {
@@ -6,14 +6,22 @@
 
 #include <QMap>
 #include <QMultiMap>
+#include <QSet>
 #include <QString>
 #include <QDateTime>
 #include <QStringList>
 
 class Catalog {
-  // Catalog of files in the pages/ folder
+  /* Catalog of files in the pages/ folder.
+     If a snapshot saved by an earlier catalog is given, the folder is
+     still listed in full, but only files whose size or modification
+     time differ from the snapshot are looked at more closely. Files
+     whose contents are unchanged despite a new modification time, as
+     after switching branches back and forth, are not reported as
+     changed. See Catalog.cpp for the format of the snapshot.
+  */
 public:
-  Catalog(QString pgdir);
+  Catalog(QString pgdir, QString snapshot=QString());
   QString path() const { return pgdir; }
   bool isValid() const { return ok; } // dir could be read
   bool isClean() const; // no errors and no duplicates
@@ -22,12 +30,32 @@ public:
   bool hasNotes(QString) const;
   QDateTime noteDirMod(QString) const;
   QStringList errors() const { return err; }
+  bool isIncremental() const { return incremental; }
+  /* True if a valid snapshot was given. */
+  QSet<int> changedPages() const { return changed; }
+  /* Pages whose files were added, removed, or modified since the
+     snapshot was taken. Only meaningful if isIncremental(). */
+  bool saveSnapshot(QString fn) const;
+  /* Does nothing if the snapshot we were given is still accurate. */
+private:
+  struct FileInfo {
+    int page;
+    qint64 size;
+    QDateTime mod;
+    QByteArray hash; // empty if not known
+  };
+  static bool loadSnapshot(QString fn, QMap<QString, FileInfo> &dst);
+  static QByteArray contentHash(QString fn);
 private:
   QString pgdir;
   QMultiMap<int, QString> pg2file;
   QMap<QString, QDateTime> filemods;
   QMap<QString, QDateTime> notemods;
+  QMap<QString, FileInfo> files;
   bool ok;
+  bool incremental;
+  bool differs; // from the snapshot
+  QSet<int> changed;
   QStringList err;
 };
 
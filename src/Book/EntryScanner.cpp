@@ -0,0 +1,194 @@
+// Book/EntryScanner.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// EntryScanner.cpp
+
+#include "EntryScanner.h"
+#include "EntryFile.h"
+#include "DataFile.h"
+#include "Entry.h"
+#include "LateNoteManager.h"
+#include "Translate.h"
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QProgressDialog>
+#include <QMessageBox>
+#include <QStringList>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#define PROGRESS_INTERVAL_MS 50
+
+class EntryScanTask: public QRunnable {
+public:
+  EntryScanTask(EntryScanner *scanner, int worker):
+    scanner(scanner), worker(worker) { }
+  virtual void run() { scanner->work(worker); }
+private:
+  EntryScanner *scanner;
+  int worker;
+};
+
+EntryScanner::EntryScanner(QString pagesDir, bool withNotes):
+  pagesDir(pagesDir), withNotes(withNotes) {
+  nWorkers = QThread::idealThreadCount();
+  if (nWorkers<1)
+    nWorkers = 1;
+}
+
+EntryScanner::~EntryScanner() {
+}
+
+void EntryScanner::add(int startPage, QString uuid) {
+  Job job;
+  job.startPage = startPage;
+  job.uuid = uuid;
+  jobs << job;
+}
+
+void EntryScanner::addFile(int startPage, QString fn) {
+  Job job;
+  job.startPage = startPage;
+  job.fn = fn;
+  jobs << job;
+}
+
+bool EntryScanner::run(QString label) {
+  next.store(0);
+  done.store(0);
+  canceled.store(0);
+  failures.clear();
+  journaled.clear();
+  if (jobs.isEmpty())
+    return true;
+
+  QProgressDialog mb(label, "Cancel", 0, jobs.size());
+  mb.setWindowModality(Qt::WindowModal);
+  mb.setMinimumDuration(200);
+  mb.setValue(0);
+
+  QThreadPool pool;
+  pool.setMaxThreadCount(nWorkers);
+  for (int w=0; w<nWorkers; w++)
+    pool.start(new EntryScanTask(this, w));
+  while (!pool.waitForDone(PROGRESS_INTERVAL_MS)) {
+    mb.setValue(done.load()); // this also processes events
+    if (mb.wasCanceled())
+      canceled.store(1); // workers stop before their next entry
+  }
+  mb.close();
+  qSort(failures);
+  qSort(journaled);
+  return !canceled.load();
+}
+
+void EntryScanner::work(int worker) {
+  while (!canceled.load()) {
+    int job = next.fetchAndAddRelaxed(1);
+    if (job>=jobs.size())
+      return;
+    scanOne(worker, job);
+    done.ref();
+  }
+}
+
+QString EntryScanner::fileName(int job) const {
+  return jobs[job].fn.isEmpty()
+    ? entryFilename(QDir(pagesDir), jobs[job].startPage, jobs[job].uuid)
+    : QDir(pagesDir).absoluteFilePath(jobs[job].fn);
+}
+
+void EntryScanner::scanOne(int worker, int job) {
+  int pg = jobs[job].startPage;
+  QString fn = fileName(job);
+  if (QFile(fn + ".journal").exists()) {
+    QMutexLocker l(&mutex);
+    journaled << pg;
+    return;
+  }
+  if (!read(worker, pg, fn)) {
+    qDebug() << "EntryScanner: Cannot load entry" << pg << fn;
+    QMutexLocker l(&mutex);
+    failures << pg;
+  }
+}
+
+bool EntryScanner::read(int worker, int pg, QString fn) {
+  Data *parsed = DataFile0::parse(fn);
+  EntryData *data = dynamic_cast<EntryData *>(parsed);
+  if (!data) {
+    delete parsed;
+    return false;
+  }
+
+  QList<Data *> notes;
+  QString notesDir = fn;
+  notesDir.replace(".json", ".notes");
+  QDir dir(notesDir);
+  if (withNotes && dir.exists()) {
+    for (QString const &nfn: dir.entryList(QStringList("*.json"),
+                                           QDir::Files)) {
+      Data *note = DataFile0::parse(dir.absoluteFilePath(nfn));
+      if (note)
+        notes << note;
+    }
+  }
+
+  scan(worker, pg, data, notes);
+
+  for (Data *note: notes)
+    delete note;
+  delete data;
+  return true;
+}
+
+void EntryScanner::scan(int, int, EntryData *, QList<Data *> const &) {
+}
+
+void EntryScanner::scanDeferred(QString when) {
+  QStringList warns;
+  for (int pg: failures)
+    warns << QString("%1").arg(pg);
+  for (int job=0; job<jobs.size(); job++) {
+    int pg = jobs[job].startPage;
+    if (!journaled.contains(pg))
+      continue;
+    EntryFile *f = jobs[job].fn.isEmpty()
+      ? ::loadEntry(QDir(pagesDir), pg, jobs[job].uuid, 0)
+      : EntryFile::load(fileName(job), 0);
+    if (!f) {
+      qDebug() << "EntryScanner: Cannot load entry" << pg << fileName(job);
+      warns << QString("%1").arg(pg);
+      continue;
+    }
+    Entry *entry = new Entry(f);
+    if (withNotes)
+      entry->lateNoteManager()->ensureLoaded();
+    scanLoaded(pg, entry);
+    f->cancelSave(); // leave any journal alone
+    delete entry;
+  }
+  if (!warns.isEmpty())
+    QMessageBox::warning(0, Translate::_("eln"),
+                         "The following pages could not be loaded "
+                         + when + ": " + warns.join(", ") + ".",
+                         QMessageBox::Close);
+}
+
+void EntryScanner::scanLoaded(int, Entry *) {
+}
@@ -0,0 +1,99 @@
+// Book/EntryScanner.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// EntryScanner.H
+
+#ifndef ENTRYSCANNER_H
+
+#define ENTRYSCANNER_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QAtomicInt>
+
+class EntryScanner {
+  /* An EntryScanner reads and parses many entries on a pool of worker
+     threads and hands each one to scan() on the thread that parsed it.
+     Workers take the next entry from a shared counter, so that a few
+     slow entries hold up only their own thread. Meanwhile, the GUI
+     thread runs a progress dialog that the user may cancel.
+     Workers only parse; they never construct EntryFiles. Entries that
+     have a journal to replay are therefore left alone and reported by
+     deferred(), for the caller to load the usual way.
+     Subclasses typically keep one partial result per worker, so that
+     scan() needs no locking, and merge them after run() returns.
+  */
+public:
+  EntryScanner(QString pagesDir, bool withNotes=true);
+  /* Unless WITHNOTES, late notes are not read. */
+  virtual ~EntryScanner();
+  void add(int startPage, QString uuid);
+  void addFile(int startPage, QString fn);
+  /* For files whose name may not match their contents. FN is relative
+     to the pages directory. */
+  bool run(QString label);
+  /* Returns false if canceled by the user. In that case, some entries
+     have been scanned and others not. */
+  int workerCount() const { return nWorkers; }
+  QList<int> failed() const { return failures; }
+  /* Start pages of entries that could not be loaded. */
+  QList<int> deferred() const { return journaled; }
+  /* Start pages of entries that were not scanned because of a journal. */
+  void scanDeferred(QString when);
+  /* For use after run() has completed: loads the deferred() entries the
+     usual way, passes them to scanLoaded(), and leaves their journals
+     alone. Then shows one warning that lists all entries that could not
+     be loaded, if any, saying that this happened WHEN, e.g., "while
+     updating the search index". */
+protected:
+  virtual bool read(int worker, int startPage, QString fn);
+  /* Called from worker thread WORKER (0 ≤ WORKER < workerCount()) for
+     each entry file FN. The default parses the entry and its late notes
+     and passes them to scan(). Subclasses that need less may read less.
+     Returns false if the entry cannot be loaded. */
+  virtual void scan(int worker, int startPage, class EntryData *data,
+                    QList<class Data *> const &notes);
+  /* NOTES are the entry's late notes. The data are deleted afterwards. */
+  virtual void scanLoaded(int startPage, class Entry *entry);
+  /* Called on the GUI thread by scanDeferred(), after the workers are
+     done, so results may go into any worker's slot. The late notes are
+     loaded unless WITHNOTES was false. The entry is deleted afterwards. */
+private:
+  friend class EntryScanTask;
+  void work(int worker);
+  void scanOne(int worker, int job);
+  QString fileName(int job) const;
+private:
+  struct Job {
+    int startPage;
+    QString uuid;
+    QString fn; // if given, overrides uuid
+  };
+  QString pagesDir;
+  bool withNotes;
+  QVector<Job> jobs;
+  int nWorkers;
+  QAtomicInt next;
+  QAtomicInt done;
+  QAtomicInt canceled;
+  QMutex mutex; // protects the following
+  QList<int> failures;
+  QList<int> journaled;
+};
+
+#endif
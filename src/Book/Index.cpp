@@ -18,37 +18,77 @@
 
 #include "Index.h"
 #include "WordIndex.h"
+#include "PhraseIndex.h"
+#include "MetaIndex.h"
 #include "ElnAssert.h"
 #include <QDebug>
 #include <QFile>
-#include <QTimer>
 #include <QSignalMapper>
 #include "EntryFile.h"
 #include "LateNoteManager.h"
-
-#define INDEX_SAVEIVAL_S 5
+#include "SaveScheduler.h"
+#include "FileWriter.h"
 
 Index::Index(QString rootDir, class TOC *toc, QObject *parent):
   QObject(parent), rootdir(rootDir) {
   widx = new WordIndex(this);
   mp = new QSignalMapper(this);
-  saveTimer = new QTimer(this);
-  connect(saveTimer, SIGNAL(timeout()), SLOT(flush()));
   connect(mp, SIGNAL(mapped(QObject*)), SLOT(updateEntry(QObject*)));
-  QString fn = rootdir + "/index.json";
-  if (QFile(fn).exists()) {
-    widx->load(fn);
+  QString fn = fileName();
+  QString oldfn = rootdir + "/index.json";
+  if (widx->load(fn)) {
     if (widx->update(toc, rootdir + "/pages"))
       widx->save(fn);
+  } else if (QFile(oldfn).exists() && widx->loadJSON(oldfn)) {
+    qDebug() << "Index: converting index.json to" << fn;
+    widx->update(toc, rootdir + "/pages");
+    if (widx->save(fn)) {
+      QFile(oldfn).remove();
+      ignoreInVC(rootdir, "index.bin");
+    }
   } else {
+    /* Either a new book, or one whose index was lost. Older books do
+       not have index.bin in their .gitignore yet. */
+    ignoreInVC(rootdir, "index.bin");
     if (widx->build(toc, rootdir + "/pages"))
       widx->save(fn);
   }
+  widx->prepareFuzzy(); // on a worker thread
+
+  pidx = new PhraseIndex(this);
+  QString pfn = phraseFileName();
+  if (!pidx->load(pfn))
+    ignoreInVC(rootdir, "phrases.bin");
+  if (pidx->update(toc, rootdir + "/pages"))
+    pidx->save(pfn);
+  midx = new MetaIndex(this);
   needToSave = false;
 }
 
+QString Index::fileName() const {
+  return rootdir + "/index.bin";
+}
+
+QString Index::phraseFileName() const {
+  return rootdir + "/phrases.bin";
+}
+
+void Index::ignoreInVC(QString rootdir, QString fn) {
+  QFile f(rootdir + "/.gitignore");
+  if (!f.exists() || !f.open(QFile::ReadWrite))
+    return;
+  QList<QByteArray> lines = f.readAll().split('\n');
+  for (QByteArray const &l: lines)
+    if (l.trimmed()==fn.toUtf8())
+      return;
+  if (!lines.last().isEmpty())
+    f.write("\n");
+  f.write(fn.toUtf8() + "\n");
+}
+
 Index::~Index() {
   flush();
+  FileWriter::instance()->waitForAll();
 }
 
 void Index::watchEntry(Entry *e) {
@@ -61,7 +101,7 @@ void Index::watchEntry(Entry *e) {
   connect(f, SIGNAL(saved()), mp, SLOT(map()), Qt::UniqueConnection);
   connect(e->lateNoteManager(), SIGNAL(mod()),
 	  mp, SLOT(map()), Qt::UniqueConnection);
-  oldsets[pgno] = e->wordSet();
+  oldcounts[pgno] = e->wordCounts();
   mp->setMapping(f, e);
   mp->setMapping(e->lateNoteManager(), e);
 }
@@ -77,7 +117,7 @@ void Index::unwatchEntry(Entry *e) {
   disconnect(e->lateNoteManager(), SIGNAL(mod()), mp, SLOT(map()));
   mp->removeMappings(f);
   mp->removeMappings(e->lateNoteManager());
-  oldsets.remove(pgno);
+  oldcounts.remove(pgno);
 }
 
 void Index::deleteEntry(Entry *e) {
@@ -86,13 +126,20 @@ void Index::deleteEntry(Entry *e) {
   ASSERT(d);
   int pgno = d->startPage();
   words()->dropEntry(pgno);
+  phrases()->dropEntry(pgno);
+  midx->dropEntry(pgno);
   unwatchEntry(e);
+  emit entryChanged(pgno);
 }
 
 void Index::flush() {
-  saveTimer->stop();
+  /* The phrase index changes with every save of an entry, but we only
+     write it out along with the word index. If we crash in between,
+     PhraseIndex::update() catches up on the next load. */
   if (needToSave)
-    words()->save(rootdir + "/index.json");
+    words()->save(fileName());
+  if (phrases()->needToSave())
+    phrases()->save(phraseFileName());
   needToSave = false;
 }
 
@@ -100,18 +147,32 @@ WordIndex *Index::words() const {
   return widx;
 }
 
+PhraseIndex *Index::phrases() const {
+  return pidx;
+}
+
+MetaIndex *Index::meta() const {
+  if (!midx->isBuilt())
+    midx->build(pidx);
+  return midx;
+}
+
 void Index::updateEntry(QObject *obj) {
   Entry *e = dynamic_cast<Entry *>(obj);
   ASSERT(e);
   EntryData *d = e->data();
   ASSERT(d);
-  QSet<QString> words = e->wordSet();
+  QHash<QString, int> counts = e->wordCounts();
   int pgno = d->startPage();
+  pidx->rebuildEntry(e);
+  if (midx->isBuilt())
+    midx->rebuildEntry(pgno, pidx->entryRecords(pgno));
 
-  if (words!=oldsets[pgno]) {
-    widx->rebuildEntry(pgno, words, &oldsets[pgno]);
-    oldsets[pgno] = words;
+  if (counts!=oldcounts[pgno]) {
+    widx->rebuildEntry(pgno, counts, &oldcounts[pgno]);
+    oldcounts[pgno] = counts;
     needToSave = true;
-    saveTimer->start(INDEX_SAVEIVAL_S * 1000);
+    SaveScheduler::instance()->scheduleFlush(this);
   }
+  emit entryChanged(pgno);
 }
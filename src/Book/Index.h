@@ -33,16 +33,30 @@ public:
   void unwatchEntry(Entry *);
   void deleteEntry(Entry *);
   class WordIndex *words() const;
+  class PhraseIndex *phrases() const;
+  class MetaIndex *meta() const;
+  /* The metadata index is built on first use. */
+  static void ignoreInVC(QString rootDir, QString fn);
+  /* Books created by older versions do not list our newer files in their
+     .gitignore. This adds FN if need be. */
 public slots:
   void updateEntry(QObject *);
   void flush();
+signals:
+  void entryChanged(int startPage);
+  /* Emitted after the indices have taken in a change to an entry, or
+     dropped it. */
+private:
+  QString fileName() const;
+  QString phraseFileName() const;
 private:
   class WordIndex *widx;
-  QMap<int, QSet<QString> > oldsets;
+  PhraseIndex *pidx;
+  class MetaIndex *midx;
+  QMap<int, QHash<QString, int> > oldcounts;
   QString rootdir;
   class QSignalMapper *mp;
   bool needToSave;
-  class QTimer *saveTimer;
 };
 
 #endif
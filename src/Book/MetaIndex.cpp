@@ -0,0 +1,282 @@
+// Book/MetaIndex.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// MetaIndex.cpp
+
+#include "MetaIndex.h"
+#include <QRegExp>
+#include <QStringList>
+#include <QDebug>
+#include <algorithm>
+#include <limits>
+#include <iterator>
+
+static qint64 const noTime = std::numeric_limits<qint64>::min();
+
+static qint64 msecs(QDateTime const &t) {
+  return t.isValid() ? t.toMSecsSinceEpoch() : noTime;
+}
+
+static bool parseDate(QString s, bool end, QDateTime &dst) {
+  /* Parses YYYY, YYYY-MM, or YYYY-MM-DD as the start of that period, or
+     if END is set, as the start of the next one. */
+  QRegExp re("(\\d\\d\\d\\d)(-(\\d\\d?))?(-(\\d\\d?))?");
+  if (!re.exactMatch(s))
+    return false;
+  int y = re.cap(1).toInt();
+  bool hasMonth = !re.cap(3).isEmpty();
+  bool hasDay = !re.cap(5).isEmpty();
+  QDate d(y, hasMonth ? re.cap(3).toInt() : 1, hasDay ? re.cap(5).toInt() : 1);
+  if (!d.isValid())
+    return false;
+  if (end)
+    d = hasDay ? d.addDays(1) : hasMonth ? d.addMonths(1) : d.addYears(1);
+  dst = QDateTime(d);
+  return true;
+}
+
+static bool parsePeriod(QString s, QDateTime &from, QDateTime &to) {
+  int idx = s.indexOf("..");
+  QString a = idx>=0 ? s.left(idx) : s;
+  QString b = idx>=0 ? s.mid(idx+2) : s;
+  if (a.isEmpty() && b.isEmpty())
+    return false;
+  if (!a.isEmpty() && !parseDate(a, false, from))
+    return false;
+  if (!b.isEmpty() && !parseDate(b, true, to))
+    return false;
+  return true;
+}
+
+static bool parseTypes(QString s, QSet<int> &dst) {
+  QSet<int> tt;
+  for (QString t: s.toLower().split(",")) {
+    if (t=="text")
+      tt << SearchResult::InTextBlock;
+    else if (t=="table")
+      tt << SearchResult::InTableBlock;
+    else if (t=="gfxnote" || t=="note")
+      tt << SearchResult::InGfxNote;
+    else if (t=="latenote")
+      tt << SearchResult::InLateNote;
+    else if (t=="footnote")
+      tt << SearchResult::InFootnote;
+    else
+      return false;
+  }
+  dst |= tt;
+  return true;
+}
+
+MetaIndex::Filter::Filter() {
+  pageFrom = pageTo = -1;
+}
+
+bool MetaIndex::Filter::isEmpty() const {
+  return types.isEmpty()
+    && creFrom.isNull() && creTo.isNull()
+    && modFrom.isNull() && modTo.isNull()
+    && pageFrom<0 && pageTo<0;
+}
+
+MetaIndex::Filter MetaIndex::Filter::parse(QString &phrase) {
+  Filter f;
+  QStringList kept;
+  QRegExp re("(type|created|modified|page):(\\S+)", Qt::CaseInsensitive);
+  for (QString w: phrase.split(QRegExp("\\s+"), QString::SkipEmptyParts)) {
+    bool ok = false;
+    if (re.exactMatch(w)) {
+      QString key = re.cap(1).toLower();
+      QString val = re.cap(2);
+      if (key=="type") {
+        ok = parseTypes(val, f.types);
+      } else if (key=="created") {
+        ok = parsePeriod(val, f.creFrom, f.creTo);
+      } else if (key=="modified") {
+        ok = parsePeriod(val, f.modFrom, f.modTo);
+      } else if (key=="page") {
+        int idx = val.indexOf("..");
+        QString a = idx>=0 ? val.left(idx) : val;
+        QString b = idx>=0 ? val.mid(idx+2) : val;
+        bool oka = true, okb = true;
+        int from = a.isEmpty() ? -1 : a.toInt(&oka);
+        int to = b.isEmpty() ? -1 : b.toInt(&okb);
+        ok = oka && okb && (from>=0 || to>=0);
+        if (ok) {
+          f.pageFrom = from;
+          f.pageTo = to;
+        }
+      }
+    }
+    if (!ok)
+      kept << w; // not a filter after all
+  }
+  if (!f.isEmpty())
+    phrase = kept.join(" ");
+  return f;
+}
+
+MetaIndex::MetaIndex(QObject *parent): QObject(parent) {
+  built = false;
+  sorted = false;
+}
+
+MetaIndex::~MetaIndex() {
+}
+
+void MetaIndex::build(PhraseIndex const *pidx) {
+  entryCol.clear();
+  typeCol.clear();
+  pageCol.clear();
+  creCol.clear();
+  modCol.clear();
+  uuidCol.clear();
+  byEntry.clear();
+  byType.clear();
+  for (int pg: pidx->entries())
+    for (PhraseIndex::Record const &r: pidx->entryRecords(pg))
+      add(pg, r.res);
+  built = true;
+}
+
+void MetaIndex::add(int pg, SearchResult const &res) {
+  int id = entryCol.size();
+  entryCol << pg;
+  typeCol << int(res.type);
+  pageCol << res.page;
+  creCol << msecs(res.cre);
+  modCol << msecs(res.mod);
+  uuidCol << res.uuid;
+  byEntry[pg] << id;
+  byType[int(res.type)] << id;
+  sorted = false;
+}
+
+void MetaIndex::rebuildEntry(int startPage,
+                             QList<PhraseIndex::Record> const &recs) {
+  if (!built)
+    return;
+  dropEntry(startPage);
+  for (PhraseIndex::Record const &r: recs)
+    add(startPage, r.res);
+}
+
+void MetaIndex::dropEntry(int startPage) {
+  /* IDs are not reused, so the columns only grow; that is fine for the
+     length of a session. */
+  if (!built)
+    return;
+  for (int id: byEntry.value(startPage)) {
+    QVector<int> &tt = byType[typeCol[id]];
+    auto it = std::lower_bound(tt.begin(), tt.end(), id);
+    if (it!=tt.end() && *it==id)
+      tt.erase(it);
+    entryCol[id] = -1;
+  }
+  byEntry.remove(startPage);
+  sorted = false;
+}
+
+void MetaIndex::sortColumns() const {
+  QVector<int> ids;
+  for (QVector<int> const &v: byEntry)
+    ids += v;
+  byPage = byCre = byMod = ids;
+  std::sort(byPage.begin(), byPage.end(), [this](int a, int b) {
+      return pageCol[a] < pageCol[b]; });
+  std::sort(byCre.begin(), byCre.end(), [this](int a, int b) {
+      return creCol[a] < creCol[b]; });
+  std::sort(byMod.begin(), byMod.end(), [this](int a, int b) {
+      return modCol[a] < modCol[b]; });
+  sorted = true;
+}
+
+template <typename T>
+static QVector<int> idsInRange(QVector<int> const &order,
+                               QVector<T> const &col, T lo, T hi) {
+  /* ORDER lists IDs sorted by COL. Returns those with values in
+     [LO, HI), sorted by ID. */
+  auto b = std::lower_bound(order.begin(), order.end(), lo,
+                            [&col](int id, T v) { return col[id] < v; });
+  auto e = std::lower_bound(b, order.end(), hi,
+                            [&col](int id, T v) { return col[id] < v; });
+  QVector<int> ids;
+  ids.reserve(e - b);
+  for (auto it=b; it!=e; ++it)
+    ids << *it;
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+static QVector<int> intersect(QVector<int> const &a, QVector<int> const &b) {
+  QVector<int> res;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(res));
+  return res;
+}
+
+QVector<int> MetaIndex::select(Filter const &f,
+                               QList<int> const *entries) const {
+  if (!sorted)
+    sortColumns();
+  QList< QVector<int> > lists;
+  if (entries) {
+    QVector<int> ids;
+    for (int pg: *entries)
+      ids += byEntry.value(pg);
+    std::sort(ids.begin(), ids.end());
+    lists << ids;
+  }
+  if (!f.types.isEmpty()) {
+    QVector<int> ids;
+    for (int t: f.types)
+      ids += byType.value(t);
+    std::sort(ids.begin(), ids.end());
+    lists << ids;
+  }
+  if (f.pageFrom>=0 || f.pageTo>=0)
+    lists << idsInRange(byPage, pageCol,
+                        f.pageFrom>=0 ? f.pageFrom : 0,
+                        f.pageTo>=0 ? f.pageTo + 1
+                        : std::numeric_limits<int>::max());
+  qint64 const never = std::numeric_limits<qint64>::max();
+  if (!f.creFrom.isNull() || !f.creTo.isNull())
+    lists << idsInRange(byCre, creCol,
+                        f.creFrom.isNull() ? noTime + 1 : msecs(f.creFrom),
+                        f.creTo.isNull() ? never : msecs(f.creTo));
+  if (!f.modFrom.isNull() || !f.modTo.isNull())
+    lists << idsInRange(byMod, modCol,
+                        f.modFrom.isNull() ? noTime + 1 : msecs(f.modFrom),
+                        f.modTo.isNull() ? never : msecs(f.modTo));
+
+  if (lists.isEmpty()) {
+    QVector<int> ids = byCre; // all live objects
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  // Start with the shortest list, so that intermediate results are small
+  std::sort(lists.begin(), lists.end(),
+            [](QVector<int> const &a, QVector<int> const &b) {
+              return a.size() < b.size(); });
+  QVector<int> res = lists.takeFirst();
+  for (QVector<int> const &l: lists) {
+    if (res.isEmpty())
+      break;
+    res = intersect(res, l);
+  }
+  return res;
+}
@@ -0,0 +1,86 @@
+// Book/MetaIndex.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// MetaIndex.H
+
+#ifndef METAINDEX_H
+
+#define METAINDEX_H
+
+#include <QObject>
+#include <QMap>
+#include <QSet>
+#include <QVector>
+#include <QDateTime>
+#include "PhraseIndex.h"
+
+class MetaIndex: public QObject {
+  /* A MetaIndex keeps the metadata of every text object in the notebook
+     in columns: the entry it belongs to, its type, the notebook page it
+     is on (not the sheet within its entry), and its creation and
+     modification times. Each object has an ID, and a query is answered
+     by producing a sorted list of IDs for each criterion and
+     intersecting those.
+     The PhraseIndex already stores all of this, so we do not keep a file
+     of our own. Instead, the columns are built from the PhraseIndex when
+     first needed, and then kept up to date along with it.
+  */
+  Q_OBJECT;
+public:
+  struct Filter {
+    Filter();
+    QSet<int> types; // SearchResult::Type values; empty means any
+    QDateTime creFrom, creTo; // "from" is inclusive, "to" exclusive
+    QDateTime modFrom, modTo; // null means unbounded
+    int pageFrom, pageTo; // inclusive; -1 means unbounded
+    bool isEmpty() const;
+    static Filter parse(QString &phrase);
+    /* Removes terms like "type:table", "modified:2016-03",
+       "created:2015..2016-06-30", and "page:12..20" from PHRASE, and
+       returns the filter they describe. Types may be combined with
+       commas. A single date stands for the whole year, month, or day. */
+  };
+public:
+  MetaIndex(QObject *parent=0);
+  virtual ~MetaIndex();
+  bool isBuilt() const { return built; }
+  void build(PhraseIndex const *);
+  void rebuildEntry(int startPage, QList<PhraseIndex::Record> const &);
+  void dropEntry(int startPage);
+  /* These do nothing until the index is built. */
+  QVector<int> select(Filter const &f, QList<int> const *entries=0) const;
+  /* Returns the IDs of objects that satisfy F, in ascending order. If
+     ENTRIES is given, only objects in those entries are considered. */
+  int entry(int id) const { return entryCol[id]; }
+  QString uuid(int id) const { return uuidCol[id]; }
+private:
+  void add(int startPage, SearchResult const &);
+  void sortColumns() const;
+private:
+  bool built;
+  QVector<int> entryCol; // -1 for dropped objects
+  QVector<int> typeCol;
+  QVector<int> pageCol;
+  QVector<qint64> creCol; // msecs since epoch
+  QVector<qint64> modCol;
+  QVector<QString> uuidCol;
+  QMap<int, QVector<int> > byEntry; // IDs of live objects, ascending
+  QMap<int, QVector<int> > byType; // ditto
+  mutable bool sorted;
+  mutable QVector<int> byPage, byCre, byMod; // live IDs in column order
+};
+
+#endif
@@ -27,12 +27,14 @@
 #include "Index.h"
 #include "Translate.h"
 #include "Catalog.h"
+#include "FileReader.h"
 
 #include <QApplication>
 #include <QMessageBox>
 #include <QTimer>
 #include <QDebug>
 #include <QProcess>
+#include <QFileInfo>
 #include "RmDir.h"
 #include "Mode.h"
 
@@ -56,6 +58,10 @@ Notebook::Notebook(QString path, bool ro0): root(QDir(path)), ro(ro0) {
   tocFile_ = 0;
   bookFile_ = 0;
   mode_ = new Mode(isReadOnly(), this);
+  maxRetained = 20;
+  maxRetainedBytes = 16*1024*1024;
+  cacheHits = 0;
+  cacheMisses = 0;
 }
 
 void Notebook::load() {
@@ -69,7 +75,7 @@ void Notebook::load() {
   bookFile_->data()->setBook(this);
 
   qDebug() << "Cataloging pages for " << root.absolutePath();
-  Catalog cat(root.filePath("pages"));
+  Catalog cat(root.filePath("pages"), root.filePath("catalog.bin"));
 
   qDebug() << "Loading TOC for " << root.absolutePath();
   tocFile_ = TOCFile::load(root.filePath("toc.json"), this);
@@ -77,12 +83,20 @@ void Notebook::load() {
     qDebug() << "Updating TOC";
     if (tocFile_->data()->update(cat)) {
       qDebug() << "TOC updated";
+      if (!cat.isIncremental())
+        Index::ignoreInVC(dirPath(), "catalog.bin");
+      /* The snapshot vouches for the TOC, so the TOC must reach the
+         disk first. The FileWriter writes in order. */
+      if (!tocFile_->needToSave() || tocFile_->saveNow())
+        cat.saveSnapshot(root.filePath("catalog.bin"));
     } else {
       qDebug() << "TOC update failed - will rebuild TOC and index";
       delete tocFile_;
       tocFile_ = 0;
       root.remove("toc.json");
       root.remove("index.json");
+      root.remove("index.bin");
+      root.remove("phrases.bin");
     }
   } else {
     qDebug() << "No TOC file found";
@@ -90,6 +104,7 @@ void Notebook::load() {
   
   if (!tocFile_) {
     qDebug() << "Trying to rebuild TOC";
+    root.remove("catalog.bin");
     TOC *t = TOC::rebuild(root.filePath("pages"));
     if (!t)
       throw QString("Could not rebuild TOC");
@@ -100,6 +115,8 @@ void Notebook::load() {
     throw QString("Could not load TOC");
   
   tocFile_->data()->setBook(this);
+  tocFile_->setSavedLast(true);
+  bookFile_->setSavedLast(true);
 
   index_ = new Index(dirPath(), toc(), this);
 
@@ -114,6 +131,16 @@ void Notebook::load() {
 Notebook::~Notebook() {
   if (needToSave())
     qDebug() << "WARNING: Notebook destructed while needing to save";
+  /* Retained entries are deleted later, by CachedPointer, but their
+     files are our children and would be deleted right now. So we hand
+     the files over to the entries, which delete them anyway. */
+  foreach (CachedEntry ce, retained)
+    if (ce.hasFile())
+      ce.file()->setParent(0);
+  retained.clear();
+  retainedOrder.clear();
+  foreach (int id, pendingLoads)
+    delete FileReader::instance()->take(id);
 }
 
 Style const &Notebook::style() const {
@@ -203,6 +230,10 @@ bool Notebook::createGitArchive(QDir d) {
     ignore.write(".*~\n");
     ignore.write("toc.json\n");
     ignore.write("index.json\n");
+    ignore.write("index.bin\n");
+    ignore.write("phrases.bin\n");
+    ignore.write("catalog.bin\n");
+    ignore.write("*.journal\n");
   }
 
   proc.start("git", QStringList() << "add" << ".");
@@ -256,16 +287,31 @@ CachedEntry Notebook::entry(int n)  {
 
   if (pgFiles.contains(n)) {
     CachedEntry ce = pgFiles[n];
-    if (ce)
+    if (ce) {
+      cacheHits++;
+      retain(n, ce);
       return ce;
+    }
   }
 
+  cacheMisses++;
   EntryFile *f = 0;
   if (toc()->contains(n)) {
     QString uuid = toc()->tocEntry(n)->uuid();
-    f = ::loadEntry(QDir(root.filePath("pages")), n, uuid, this);
+    EntryData *parsed = 0;
+    if (pendingLoads.contains(n)) {
+      Data *d = FileReader::instance()->take(pendingLoads.take(n));
+      parsed = dynamic_cast<EntryData *>(d);
+      if (!parsed)
+        delete d;
+    }
+    f = ::loadEntry(QDir(root.filePath("pages")), n, uuid, this, parsed);
     if (!f) 
       f = recoverFromMissingEntry(n);
+    else if (isReadOnly())
+      f->cancelSave(); // keeps any journal as it is
+    else if (f->hasJournal())
+      f->compactJournal();
   } else {
     f = recoverFromMissingEntry(n);
   }
@@ -278,9 +324,85 @@ CachedEntry Notebook::entry(int n)  {
   connect(entry.data(), SIGNAL(sheetCountMod()), SLOT(sheetCountMod()));
   index_->watchEntry(entry.obj());
   connect(entry.data(), SIGNAL(mod()), this, SIGNAL(mod()));
+  retain(n, entry);
   return entry;
 }
 
+bool Notebook::entryAsync(int n) {
+  ASSERT(tocFile_);
+  if (pgFiles.contains(n) && pgFiles[n].obj())
+    return true;
+  if (pendingLoads.contains(n))
+    return false;
+  if (!toc()->contains(n))
+    return true; // entry() will have to recover, and that cannot wait
+  QString uuid = toc()->tocEntry(n)->uuid();
+  FileReader *fr = FileReader::instance();
+  connect(fr, SIGNAL(parsed(int, bool)), this, SLOT(entryParsed(int, bool)),
+          Qt::UniqueConnection);
+  pendingLoads[n] = fr->read(::entryFilename(QDir(root.filePath("pages")),
+                                             n, uuid));
+  return false;
+}
+
+void Notebook::entryParsed(int id, bool ok) {
+  for (auto it=pendingLoads.begin(); it!=pendingLoads.end(); ++it) {
+    if (it.value()==id) {
+      int n = it.key();
+      if (!ok) {
+        /* Nobody asked for this entry yet. If someone does, entry() will
+           deal with the problem. */
+        pendingLoads.erase(it);
+        delete FileReader::instance()->take(id);
+        return;
+      }
+      entry(n); // this collects the data and retains the entry
+      emit entryLoaded(n);
+      return;
+    }
+  }
+}
+
+void Notebook::setRetention(int maxEntries, qint64 maxBytes) {
+  maxRetained = maxEntries;
+  maxRetainedBytes = maxBytes;
+  trimRetained();
+}
+
+void Notebook::retain(int n, CachedEntry const &entry) {
+  if (retained.contains(n)) {
+    retainedOrder.removeOne(n);
+  } else {
+    retained[n] = entry;
+    retainedSize[n] = entry.hasFile()
+      ? QFileInfo(entry.file()->fileName()).size() : 0;
+  }
+  retainedOrder.prepend(n);
+  trimRetained();
+}
+
+void Notebook::release(int n) {
+  retained.remove(n);
+  retainedSize.remove(n);
+  retainedOrder.removeOne(n);
+}
+
+void Notebook::trimRetained() {
+  qint64 bytes = 0;
+  foreach (qint64 b, retainedSize)
+    bytes += b;
+  /* Never let go of the most recently used one. */
+  for (int k=retainedOrder.size()-1; k>0; k--) {
+    if (retainedOrder.size()<=maxRetained && bytes<=maxRetainedBytes)
+      break;
+    int n = retainedOrder[k];
+    if (retained[n].needToSave())
+      continue;
+    bytes -= retainedSize[n];
+    release(n);
+  }
+}
+
 CachedEntry Notebook::createEntry(int n) {
   ASSERT(tocFile_);
   ASSERT(!isReadOnly());
@@ -303,6 +425,7 @@ CachedEntry Notebook::createEntry(int n) {
   index_->watchEntry(entry.obj());
   connect(entry.data(), SIGNAL(mod()), this, SIGNAL(mod()));
   //  bookData()->setEndDate(QDate::currentDate());
+  retain(n, entry);
   return entry;
 }
 
@@ -327,6 +450,7 @@ bool Notebook::deleteEntry(int pgno) {
   index_->deleteEntry(pf.obj()); // this doesn't save, but see below
 
   pf.file()->cancelSave();
+  release(pgno);
   pgFiles.remove(pgno);
 
   if (!toc()->deleteEntry(toc()->find(pgno))) {
@@ -392,6 +516,10 @@ bool Notebook::flush() {
   }
 
   foreach (CachedEntry pf, pgFiles) {
+    if (pf && pf.hasFile() && pf.file()->hasJournal()) {
+      actv = true;
+      ok = ok && pf.file()->compactJournal();
+    }
     if (pf && pf.needToSave()) {
       actv = true;
       ok = ok && pf.saveNow();
@@ -400,6 +528,11 @@ bool Notebook::flush() {
 
   index_->flush();
 
+  DataFile0::finishAllWrites();
+  foreach (CachedEntry pf, pgFiles)
+    if (pf && pf.hasFile())
+      ok = ok && pf.file()->ok();
+
   if (!ok)
     qDebug() << "Notebook flushed, with errors";
 
@@ -423,6 +556,8 @@ CachedEntry Notebook::recoverFromExistingEntry(int pgno) {
   flush();
   root.remove("toc.json");
   root.remove("index.json");
+  root.remove("index.bin");
+  root.remove("phrases.bin");
   ::exit(1);
   return CachedEntry();
 }
@@ -437,6 +572,8 @@ EntryFile *Notebook::recoverFromMissingEntry(int pgno) {
   flush();
   root.remove("toc.json");
   root.remove("index.json");
+  root.remove("index.bin");
+  root.remove("phrases.bin");
   ::exit(1);
   return 0;
 }
@@ -49,6 +49,11 @@ public:
   CachedEntry entry(int pgno);
   /* If the entry does not exist, we assume TOC corruption and try to recover.
      If recovery fails, the program exits. */
+  bool entryAsync(int pgno);
+  /* Starts loading an entry in the background. Returns true if the entry
+     is already available, in which case entry() returns immediately.
+     Otherwise, entryLoaded() is emitted once it is. Calling entry() before
+     then is allowed; it simply waits. */
   CachedEntry createEntry(int pgno);
   /* The entry must not already exist. Else, the program exits. */
   bool deleteEntry(int pgno);
@@ -61,8 +66,17 @@ public:
   QString dirPath() const; // path of root
   bool needToSave() const;
   class Mode *mode() const;
+  void setRetention(int maxEntries, qint64 maxBytes);
+  /* Entries are kept loaded after their last outside user lets go, up
+     to MAXENTRIES of them or until their files add up to MAXBYTES,
+     whichever comes first. Least recently used entries are let go
+     first, but never while they have unsaved changes. */
+  int entryCacheHits() const { return cacheHits; }
+  int entryCacheMisses() const { return cacheMisses; }
+  /* Counts of calls to entry() that did or did not need to load a file. */
 signals:
   void mod();
+  void entryLoaded(int pgno);
 public slots:
   bool flush();
   void markReadOnly();
@@ -71,16 +85,28 @@ private:
 private slots:
   void titleMod();
   void sheetCountMod();
+  void entryParsed(int id, bool ok);
 private:
   CachedEntry recoverFromExistingEntry(int pgno);
   EntryFile *recoverFromMissingEntry(int pgno);
   static QString &errMsg();
   static void copyStyleFile(QDir, QString vc);
   static bool createGitArchive(QDir);
+  void retain(int pgno, CachedEntry const &);
+  void release(int pgno);
+  void trimRetained();
 private:
   QDir root;
   bool ro;
   QMap<int, CachedEntry> pgFiles;
+  QMap<int, CachedEntry> retained;
+  QMap<int, qint64> retainedSize;
+  QList<int> retainedOrder; // most recently used first
+  int maxRetained;
+  qint64 maxRetainedBytes;
+  int cacheHits;
+  int cacheMisses;
+  QMap<int, int> pendingLoads; // page number to FileReader ID
   TOCFile *tocFile_;
   BookFile *bookFile_;
   Index *index_;
@@ -0,0 +1,564 @@
+// Book/PhraseIndex.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PhraseIndex.cpp
+
+#include "PhraseIndex.h"
+#include "TOC.h"
+#include "Entry.h"
+#include "EntryFile.h"
+#include "TitleData.h"
+#include "TextBlockData.h"
+#include "TableBlockData.h"
+#include "TableData.h"
+#include "LateNoteData.h"
+#include "FootnoteData.h"
+#include "GfxNoteData.h"
+#include "LateNoteManager.h"
+#include "FileWriter.h"
+#include "Tokenizer.h"
+#include "PhraseMatcher.h"
+#include "EntryScanner.h"
+#include <QDataStream>
+#include <QVector>
+#include <QtEndian>
+#include <QDebug>
+#include <algorithm>
+
+/* The index file consists of:
+
+     Header (24 bytes):
+       char[8] magic: "ELNPIDX" followed by a zero byte
+       u32 version (1)
+       u32 nEntries
+       u32 blobSize
+       u32 reserved (0)
+     Entry table, sorted by start page: nEntries times
+       i32 startPage, u32 blobOffset, u32 blobLength
+     Blobs: for each entry, a QDataStream (Qt 5.0 format) containing
+       QDateTime seen
+       qint32 nRecords
+       nRecords times:
+         qint32 type, qint32 page, qint32 startPageOfEntry,
+         QString entryTitle, QString uuid, QDateTime cre, QDateTime mod,
+         QString context, QMap<QString, QList<int>> offsets
+
+   All numbers in the header and table are little-endian.
+*/
+
+static char const pidxMagic[8] = { 'E', 'L', 'N', 'P', 'I', 'D', 'X', 0 };
+static quint32 const pidxVersion = 1;
+static int const pidxHeaderSize = 24;
+static int const pidxEntrySize = 12;
+
+static inline quint32 getU32(uchar const *p) {
+  return qFromLittleEndian<quint32>(p);
+}
+
+static inline void putU32(QByteArray &dst, quint32 x) {
+  uchar b[4];
+  qToLittleEndian<quint32>(x, b);
+  dst.append((char const *)b, 4);
+}
+
+static QMap<QString, QList<int> > wordOffsets(QString const &text) {
+  // Words as TextData splits them
+  QMap<QString, QList<int> > offsets;
+  Tokenizer tok(text);
+  while (tok.next())
+    offsets[tok.word()] << tok.start();
+  return offsets;
+}
+
+static QString untable(TableData const *tbld) {
+  QString res = "";
+  for (int r=0; r<tbld->rows(); r++) {
+    if (r>0)
+      res += "\n";
+    for (int c=0; c<tbld->columns(); c++) {
+      if (c>0)
+        res += " | ";
+      res += tbld->cellContents(r, c);
+    }
+  }
+  return res;
+}
+
+static void collect(QList<PhraseIndex::Record> &dest, QString entryTitle,
+                    Data const *data, int entryPage, int dataPage) {
+  foreach (Data const *d, data->allChildren()) {
+    TextData const *td = dynamic_cast<TextData const *>(d);
+    if (td && !td->text().isEmpty()) {
+      PhraseIndex::Record rec;
+      SearchResult &res = rec.res;
+      if (dynamic_cast<TableBlockData const *>(data))
+        res.type = SearchResult::InTableBlock;
+      else if (dynamic_cast<TextBlockData const *>(data))
+        res.type = SearchResult::InTextBlock;
+      else if (dynamic_cast<LateNoteData const *>(data))
+        res.type = SearchResult::InLateNote;
+      else if (dynamic_cast<GfxNoteData const *>(data))
+        res.type = SearchResult::InGfxNote;
+      else if (dynamic_cast<FootnoteData const *>(data))
+        res.type = SearchResult::InFootnote;
+      else
+        res.type = SearchResult::Unknown;
+      res.page = dataPage;
+      res.startPageOfEntry = entryPage;
+      res.entryTitle = entryTitle;
+      TableData const *tbld = dynamic_cast<TableData const *>(td);
+      if (tbld)
+        res.context = untable(tbld);
+      else
+        res.context = td->text();
+      res.cre = td->created();
+      res.mod = td->modified();
+      res.uuid = td->uuid();
+      rec.offsets = wordOffsets(res.context);
+      dest << rec;
+    }
+    GfxNoteData const *nd = dynamic_cast<GfxNoteData const *>(d);
+    int childSheet = nd ? nd->sheet() : -1;
+    int childPage = childSheet>=0 ? entryPage + childSheet : dataPage;
+    collect(dest, entryTitle, d, entryPage, childPage);
+  }
+}
+
+static QList<PhraseIndex::Record> entryRecords(EntryData *ed,
+                                       QList<LateNoteData *> const &notes) {
+  QList<PhraseIndex::Record> recs;
+  int pgno = ed->startPage();
+  QString ttl = ed->titleText();
+  foreach (TitleData const *bd, ed->children<TitleData>())
+    collect(recs, ttl, bd, pgno, pgno);
+  foreach (BlockData const *bd, ed->children<BlockData>())
+    collect(recs, ttl, bd, pgno, pgno + bd->sheet());
+  foreach (LateNoteData const *bd, notes)
+    collect(recs, ttl, bd, pgno, pgno + bd->sheet());
+  return recs;
+}
+
+QList<PhraseIndex::Record> PhraseIndex::records(Entry *entry) {
+  QList<LateNoteData *> notes;
+  if (entry->hasFile())
+    notes = entry->lateNoteManager()->notes();
+  return entryRecords(entry->data(), notes);
+}
+
+class PhraseScanner: public EntryScanner {
+  /* Every worker encodes the entries it scanned into blocks of its own,
+     which PhraseIndex::update merges into the overlay. */
+public:
+  PhraseScanner(QString pagesDir):
+    EntryScanner(pagesDir), blocks(workerCount()) { }
+protected:
+  virtual void scan(int worker, int pg, EntryData *data,
+                    QList<Data *> const &notes) {
+    QList<LateNoteData *> lnotes;
+    for (Data *d: notes) {
+      LateNoteData *lnd = dynamic_cast<LateNoteData *>(d);
+      if (lnd)
+        lnotes << lnd;
+    }
+    blocks[worker][pg] = PhraseIndex::encode(QDateTime::currentDateTime(),
+                                             entryRecords(data, lnotes));
+  }
+  virtual void scanLoaded(int pg, Entry *entry) {
+    blocks[0][pg] = PhraseIndex::encode(QDateTime::currentDateTime(),
+                                        records(entry));
+  }
+public:
+  QVector<QMap<int, QByteArray> > blocks;
+};
+
+bool PhraseIndex::match(Record const &rec, QString phrase,
+                        SearchResult &dest) {
+  return match(rec, PhraseMatcher(phrase), dest);
+}
+
+bool PhraseIndex::match(Record const &rec, PhraseMatcher const &matcher,
+                        SearchResult &dest) {
+  /* Hits are found by scanning the context, because a phrase may start
+     or end inside a word. The word offsets only serve to rule records
+     out quickly: a word that the phrase delimits on both sides must
+     occur as a word in the text, and one that it delimits only in front
+     must start one. We trust that only for ASCII words, which the
+     Tokenizer and the PhraseMatcher fold alike. */
+  QString const &ctx = rec.res.context;
+  QString const &phrase = matcher.phrase();
+  if (phrase.trimmed().isEmpty()) {
+    // Matches everything, for searches that only filter by metadata
+    dest = rec.res;
+    dest.phrase = "";
+    dest.whereInContext.clear();
+    return true;
+  }
+  int n = phrase.size();
+  int k = 0;
+  while (k<n) {
+    int k0 = k;
+    bool ascii = true;
+    while (k<n && Tokenizer::isWordChar(phrase[k])) {
+      ascii = ascii && phrase[k].unicode()<0x80;
+      k++;
+    }
+    if (k==k0) {
+      k++;
+      continue;
+    }
+    if (k0==0 || !ascii)
+      continue;
+    QString w = Tokenizer::fold(phrase.mid(k0, k-k0));
+    if (k<n) {
+      if (!rec.offsets.contains(w))
+        return false;
+    } else {
+      auto it = rec.offsets.lowerBound(w);
+      if (it==rec.offsets.end() || !it.key().startsWith(w))
+        return false;
+    }
+  }
+  QList<int> where;
+  for (int i0=matcher.indexIn(ctx); i0>=0; i0=matcher.indexIn(ctx, i0+1))
+    where << i0;
+  if (where.isEmpty())
+    return false;
+  dest = rec.res;
+  dest.phrase = phrase;
+  dest.whereInContext = where;
+  return true;
+}
+
+PhraseIndex::PhraseIndex(QObject *parent): QObject(parent) {
+  mapped = 0;
+  nEntries = 0;
+  entryTable = blobs = 0;
+  dirty = false;
+}
+
+PhraseIndex::~PhraseIndex() {
+  detach();
+}
+
+void PhraseIndex::clear() {
+  detach();
+  overlay.clear();
+  dirty = false;
+}
+
+void PhraseIndex::detach() {
+  if (mapped) {
+    mapped->close(); // this unmaps
+    delete mapped;
+    mapped = 0;
+  }
+  baseBuffer.clear();
+  nEntries = 0;
+  entryTable = blobs = 0;
+}
+
+static bool checkIndex(uchar const *data, qint64 size) {
+  if (size < pidxHeaderSize || memcmp(data, pidxMagic, 8)!=0) {
+    qDebug() << "PhraseIndex: Not an index file";
+    return false;
+  }
+  if (getU32(data + 8) != pidxVersion) {
+    qDebug() << "PhraseIndex: Unknown index version" << getU32(data + 8);
+    return false;
+  }
+  quint32 ne = getU32(data + 12);
+  quint32 bs = getU32(data + 16);
+  if (size < pidxHeaderSize + qint64(ne)*pidxEntrySize + bs) {
+    qDebug() << "PhraseIndex: Truncated index file";
+    return false;
+  }
+  uchar const *et = data + pidxHeaderSize;
+  for (quint32 k=0; k<ne; k++) {
+    uchar const *e = et + k*pidxEntrySize;
+    if (qint64(getU32(e+4)) + getU32(e+8) > bs) {
+      qDebug() << "PhraseIndex: Corrupt index file";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PhraseIndex::attach(uchar const *data, qint64 size) {
+  if (!checkIndex(data, size))
+    return false;
+  quint32 ne = getU32(data + 12);
+  uchar const *et = data + pidxHeaderSize;
+  nEntries = ne;
+  entryTable = et;
+  blobs = et + qint64(ne)*pidxEntrySize;
+  return true;
+}
+
+bool PhraseIndex::load(QString filename) {
+  clear();
+  QFile *f = new QFile(filename);
+  if (!f->open(QFile::ReadOnly)) {
+    delete f;
+    return false;
+  }
+  qint64 size = f->size();
+  uchar *data = f->map(0, size);
+  if (data) {
+    mapped = f;
+  } else {
+    baseBuffer = f->readAll();
+    delete f;
+    data = (uchar *)baseBuffer.data();
+  }
+  if (!attach(data, size)) {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+int PhraseIndex::findBase(int startPage) const {
+  int lo = 0;
+  int hi = nEntries;
+  while (lo<hi) {
+    int mid = (lo + hi) / 2;
+    if (qFromLittleEndian<qint32>(entryTable + mid*pidxEntrySize)
+        < startPage)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo<int(nEntries)
+      && qFromLittleEndian<qint32>(entryTable + lo*pidxEntrySize)
+      == startPage)
+    return lo;
+  return -1;
+}
+
+QByteArray PhraseIndex::block(int startPage) const {
+  auto it = overlay.find(startPage);
+  if (it!=overlay.end())
+    return it.value();
+  int k = findBase(startPage);
+  if (k<0)
+    return QByteArray();
+  uchar const *e = entryTable + k*pidxEntrySize;
+  return QByteArray::fromRawData((char const *)blobs + getU32(e+4),
+                                 getU32(e+8));
+}
+
+bool PhraseIndex::contains(int startPage) const {
+  return !block(startPage).isEmpty();
+}
+
+QByteArray PhraseIndex::encode(QDateTime seen, QList<Record> const &recs) {
+  QByteArray ba;
+  QDataStream s(&ba, QIODevice::WriteOnly);
+  s.setVersion(QDataStream::Qt_5_0);
+  s << seen << qint32(recs.size());
+  for (Record const &r: recs)
+    s << qint32(r.res.type) << qint32(r.res.page)
+      << qint32(r.res.startPageOfEntry)
+      << r.res.entryTitle << r.res.uuid << r.res.cre << r.res.mod
+      << r.res.context << r.offsets;
+  return ba;
+}
+
+QList<PhraseIndex::Record> PhraseIndex::decode(QByteArray const &ba,
+                                               QDateTime *seen) {
+  QList<Record> recs;
+  QDataStream s(ba);
+  s.setVersion(QDataStream::Qt_5_0);
+  QDateTime t;
+  qint32 n = 0;
+  s >> t >> n;
+  if (seen) {
+    *seen = t;
+    return recs;
+  }
+  for (int k=0; k<n && s.status()==QDataStream::Ok; k++) {
+    Record r;
+    qint32 type, page, start;
+    s >> type >> page >> start
+      >> r.res.entryTitle >> r.res.uuid >> r.res.cre >> r.res.mod
+      >> r.res.context >> r.offsets;
+    r.res.type = SearchResult::Type(type);
+    r.res.page = page;
+    r.res.startPageOfEntry = start;
+    recs << r;
+  }
+  if (s.status()!=QDataStream::Ok)
+    qDebug() << "PhraseIndex: Corrupt block";
+  return recs;
+}
+
+void PhraseIndex::rebuildEntry(Entry *entry) {
+  int pgno = entry->data()->startPage();
+  overlay[pgno] = encode(QDateTime::currentDateTime(), records(entry));
+  dirty = true;
+}
+
+void PhraseIndex::dropEntry(int startPage) {
+  if (findBase(startPage)>=0)
+    overlay[startPage] = QByteArray();
+  else
+    overlay.remove(startPage);
+  dirty = true;
+}
+
+QList<int> PhraseIndex::entries() const {
+  QList<int> pp;
+  for (int k=0; k<int(nEntries); k++) {
+    int pg = qFromLittleEndian<qint32>(entryTable + k*pidxEntrySize);
+    if (!overlay.contains(pg))
+      pp << pg;
+  }
+  for (auto it=overlay.begin(); it!=overlay.end(); ++it)
+    if (!it.value().isEmpty())
+      pp << it.key();
+  std::sort(pp.begin(), pp.end());
+  return pp;
+}
+
+QList<PhraseIndex::Record> PhraseIndex::entryRecords(int startPage) const {
+  return decode(block(startPage));
+}
+
+QByteArray PhraseIndex::blockCopy(int startPage) const {
+  QByteArray b = block(startPage);
+  if (overlay.contains(startPage))
+    return b; // implicitly shared, and that is safe across threads
+  return QByteArray(b.constData(), b.size()); // detach from the mapping
+}
+
+QList<SearchResult> PhraseIndex::find(int startPage, QString phrase) const {
+  return findInBlock(block(startPage), phrase);
+}
+
+QList<SearchResult> PhraseIndex::findInBlock(QByteArray const &block,
+                                             QString phrase) {
+  QList<SearchResult> results;
+  PhraseMatcher matcher(phrase);
+  for (Record const &r: decode(block)) {
+    SearchResult res;
+    if (match(r, matcher, res))
+      results << res;
+  }
+  return results;
+}
+
+QByteArray PhraseIndex::encodeAll() const {
+  QByteArray table;
+  QByteArray blob;
+  quint32 ne = 0;
+  auto add = [&](int pg, char const *data, int len) {
+    putU32(table, quint32(pg));
+    putU32(table, blob.size());
+    putU32(table, len);
+    blob.append(data, len);
+    ne++;
+  };
+
+  auto ovl = overlay.begin();
+  int k = 0;
+  while (k<int(nEntries) || ovl!=overlay.end()) {
+    uchar const *e = k<int(nEntries) ? entryTable + k*pidxEntrySize : 0;
+    int pg = e ? qFromLittleEndian<qint32>(e) : 0;
+    if (ovl!=overlay.end() && (!e || ovl.key()<=pg)) {
+      if (e && ovl.key()==pg)
+        k++;
+      if (!ovl.value().isEmpty())
+        add(ovl.key(), ovl.value().constData(), ovl.value().size());
+      ++ovl;
+    } else {
+      add(pg, (char const *)blobs + getU32(e+4), getU32(e+8));
+      k++;
+    }
+  }
+
+  QByteArray out;
+  out.reserve(pidxHeaderSize + table.size() + blob.size());
+  out.append(pidxMagic, 8);
+  putU32(out, pidxVersion);
+  putU32(out, ne);
+  putU32(out, blob.size());
+  putU32(out, 0);
+  out += table;
+  out += blob;
+  return out;
+}
+
+bool PhraseIndex::save(QString filename) {
+  /* As in WordIndex::save, we switch over to the encoded data, so that
+     the file is not mapped while it is being replaced. */
+  QByteArray bin = encodeAll();
+  if (!checkIndex((uchar const *)bin.constData(), bin.size())) {
+    qDebug() << "PhraseIndex: Failed to encode index";
+    return false; // keeping what we have
+  }
+  detach();
+  overlay.clear();
+  baseBuffer = bin;
+  attach((uchar const *)baseBuffer.constData(), baseBuffer.size());
+  FileWriter::instance()->write(filename, bin, FileWriter::ReplaceBinary);
+  dirty = false;
+  return true;
+}
+
+bool PhraseIndex::update(TOC const *toc, QString pagesDir) {
+  bool changed = false;
+  QList<int> gone;
+  for (int k=0; k<int(nEntries); k++) {
+    int pg = qFromLittleEndian<qint32>(entryTable + k*pidxEntrySize);
+    if (!toc->contains(pg))
+      gone << pg;
+  }
+  for (int pg: overlay.keys())
+    if (!toc->contains(pg))
+      gone << pg;
+  for (int pg: gone) {
+    dropEntry(pg);
+    changed = true;
+  }
+
+  PhraseScanner scanner(pagesDir);
+  int n = 0;
+  for (TOCEntry const *entry: toc->entries()) {
+    QByteArray b = block(entry->startPage());
+    QDateTime seen;
+    if (!b.isEmpty())
+      decode(b, &seen);
+    if (b.isEmpty() || entry->modified()>seen.addSecs(10)) {
+      scanner.add(entry->startPage(), entry->uuid());
+      n++;
+    }
+  }
+  
+  if (n==0)
+    return changed;
+
+  bool complete = scanner.run("Updating phrase index...");
+  if (complete)
+    scanner.scanDeferred("while updating the phrase index");
+  /* Even if canceled, whatever was scanned is worth keeping. */
+  for (QMap<int, QByteArray> const &bb: scanner.blocks) {
+    for (auto it=bb.begin(); it!=bb.end(); ++it)
+      overlay[it.key()] = it.value();
+    if (!bb.isEmpty())
+      dirty = changed = true;
+  }
+  return complete || changed;
+}
@@ -0,0 +1,96 @@
+// Book/PhraseIndex.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PhraseIndex.H
+
+#ifndef PHRASEINDEX_H
+
+#define PHRASEINDEX_H
+
+#include <QObject>
+#include <QMap>
+#include <QFile>
+#include <QDateTime>
+#include "SearchResult.h"
+
+class PhraseIndex: public QObject {
+  /* A PhraseIndex stores, for every entry, what a search needs to know
+     about each of its text objects: everything that goes into a
+     SearchResult, plus the character offsets of each word. Phrase
+     searches can then be answered without loading any entries.
+     Like the WordIndex, it lives in a memory-mapped file with an overlay
+     of entries that changed since it was last saved. Each entry is
+     stored as a separate block, which is only decoded when the entry is
+     a candidate for a search.
+  */
+  Q_OBJECT;
+public:
+  struct Record {
+    SearchResult res; // without phrase or whereInContext
+    QMap<QString, QList<int> > offsets; // lower-case word to positions
+  };
+public:
+  PhraseIndex(QObject *parent=0);
+  virtual ~PhraseIndex();
+  bool load(QString filename);
+  bool save(QString filename);
+  /* The actual writing happens on the FileWriter thread. */
+  bool update(class TOC const *toc, QString pagesDir);
+  /* Indexes entries that are missing or out of date. Returns true if
+     anything changed. */
+  void rebuildEntry(class Entry *entry);
+  void dropEntry(int startPage);
+  bool contains(int startPage) const;
+  QList<int> entries() const; // start pages of all indexed entries
+  QList<Record> entryRecords(int startPage) const;
+  bool needToSave() const { return dirty; }
+  QList<SearchResult> find(int startPage, QString phrase) const;
+  /* PHRASE is matched case-insensitively, anywhere in the text. */
+  QByteArray blockCopy(int startPage) const;
+  /* The stored form of an entry, which remains valid after the index
+     changes, for use with findInBlock() on another thread. */
+  static QList<SearchResult> findInBlock(QByteArray const &block,
+                                         QString phrase);
+public:
+  static QList<Record> records(class Entry *entry);
+  /* Collects the text objects of an entry, whether indexed or not. */
+  static bool match(Record const &rec, QString phrase, SearchResult &dest);
+  /* Fills DEST and returns true if PHRASE occurs in REC. An empty
+     phrase occurs everywhere. */
+  static bool match(Record const &rec, class PhraseMatcher const &phrase,
+                    SearchResult &dest);
+  /* Same, for checking many records against one phrase. */
+private:
+  friend class PhraseScanner;
+  void clear();
+  void detach();
+  bool attach(uchar const *data, qint64 size);
+  int findBase(int startPage) const; // -1 if not found
+  QByteArray block(int startPage) const; // empty if none
+  static QByteArray encode(QDateTime seen, QList<Record> const &);
+  static QList<Record> decode(QByteArray const &, QDateTime *seen=0);
+  QByteArray encodeAll() const;
+private:
+  QFile *mapped;
+  QByteArray baseBuffer;
+  quint32 nEntries;
+  uchar const *entryTable;
+  uchar const *blobs;
+  QMap<int, QByteArray> overlay; // empty blocks mark dropped entries
+  bool dirty;
+};
+
+#endif
@@ -18,167 +18,331 @@
 
 #include "Search.h"
 
-#include "TextBlockData.h"
-#include "TitleData.h"
-#include "TableBlockData.h"
-#include "LateNoteData.h"
-#include "FootnoteData.h"
 #include "Index.h"
 #include "WordIndex.h"
+#include "PhraseIndex.h"
+#include "MetaIndex.h"
+#include "Tokenizer.h"
+#include "PhraseMatcher.h"
 #include "ElnAssert.h"
-#include "LateNoteManager.h"
 
 #include <QSet>
 #include <QDebug>
-#include "TableData.h"
+#include <QRunnable>
+#include <algorithm>
 
-Search::Search(Notebook *book): book(book) {
+#define CHUNK_SIZE 16
+#define DELIVERY_INTERVAL_MS 100
+
+class SearchTask: public QRunnable {
+public:
+  SearchTask(Search *search, int gen, QString phrase,
+             QList<QByteArray> blocks):
+    search(search), gen(gen), phrase(phrase), blocks(blocks) { }
+  virtual void run() { search->verify(gen, phrase, blocks); }
+private:
+  Search *search;
+  int gen;
+  QString phrase;
+  QList<QByteArray> blocks;
+};
+
+Search::Search(Notebook *book, QObject *parent):
+  QObject(parent), book(book) {
+  running = false;
+  complete = false;
+  tasksLeft = 0;
+  announced = 0;
+  fuzzy = false;
+  filtering = false;
+  rankLimit = 0;
+  ranked = false;
+  nCandidates = 0;
+  deliveryTimer = new QTimer(this);
+  deliveryTimer->setSingleShot(true);
+  deliveryTimer->setInterval(DELIVERY_INTERVAL_MS);
+  connect(deliveryTimer, SIGNAL(timeout()), SLOT(deliver()));
+  connect(book->index(), SIGNAL(entryChanged(int)),
+          SLOT(forgetRefinement()));
+}
+
+void Search::setRankLimit(int n) {
+  rankLimit = n;
+}
+
+void Search::setFuzzy(bool f) {
+  fuzzy = f;
 }
 
 Search::~Search() {
+  generation.ref();
+  pool.waitForDone(); // workers stop at their next candidate
 }
 
-QString Search::untable(TableData const *tbld) {
-  QString res = "";
-  for (int r=0; r<tbld->rows(); r++) {
-    if (r>0)
-      res += "\n";
-    for (int c=0; c<tbld->columns(); c++) {
-      if (c>0)
-        res += " | ";
-      res += tbld->cellContents(r, c);
-    }
-  }
-  return res;
-}
-
-void Search::addToResults(QList<SearchResult> &dest, QString phrase,
-                          QString entryTitle,
-                          Data const *data, int entryPage, int dataPage) {
-  foreach (Data const *d, data->allChildren()) {
-    TextData const *td = dynamic_cast<TextData const *>(d);
-    if (td && td->text().toLower().contains(phrase)) {
-      // gotcha
-      SearchResult res;
-      res.phrase = phrase;
-      if (dynamic_cast<TableBlockData const *>(data))
-        res.type = SearchResult::InTableBlock;
-      else if (dynamic_cast<TextBlockData const *>(data))
-        res.type = SearchResult::InTextBlock;
-      else if (dynamic_cast<TextBlockData const *>(data))
-        res.type = SearchResult::InTextBlock;
-      else if (dynamic_cast<LateNoteData const *>(data))
-        res.type = SearchResult::InLateNote;
-      else if (dynamic_cast<GfxNoteData const *>(data))
-        res.type = SearchResult::InGfxNote;
-      else if (dynamic_cast<FootnoteData const *>(data))
-        res.type = SearchResult::InFootnote;
-      else
-        res.type = SearchResult::Unknown;
-      res.page = dataPage;
-      res.startPageOfEntry = entryPage;
-      res.entryTitle = entryTitle;
-      TableData const *tbld = dynamic_cast<TableData const *>(td);
-      if (tbld)
-        res.context = untable(tbld);
-      else
-        res.context = td->text();
-      res.cre = td->created();
-      res.mod = td->modified();
-      res.uuid = td->uuid();
-      int i0 = res.context.indexOf(phrase, 0, Qt::CaseInsensitive);
-      while (i0>=0) {
-        res.whereInContext << i0;
-        i0 = res.context.indexOf(phrase, i0+1, Qt::CaseInsensitive);
-      }
-      dest << res;      
-    }
-    GfxNoteData const *nd = dynamic_cast<GfxNoteData const *>(d);
-    int childSheet = nd ? nd->sheet() : -1;
-    int childPage = childSheet>=0 ? entryPage + childSheet : dataPage;
-    addToResults(dest, phrase, entryTitle, d, entryPage, childPage);
+QList<SearchResult> Search::findInEntry(int pgno, QString phrase) const {
+  /* Normally, the phrase index has all we need. Only entries that it
+     does not know about yet need to be loaded. */
+  PhraseIndex const *pidx = book->index()->phrases();
+  if (pidx->contains(pgno))
+    return pidx->find(pgno, phrase);
+
+  QList<SearchResult> results;
+  CachedEntry ef(book->entry(pgno));
+  ASSERT(ef);
+  PhraseMatcher matcher(phrase);
+  for (PhraseIndex::Record const &r: PhraseIndex::records(ef.obj())) {
+    SearchResult res;
+    if (PhraseIndex::match(r, matcher, res))
+      results << res;
   }
+  return results;
 }
 
 QList<SearchResult> Search::immediatelyFindPhrase(QString phrase) const {
-  QStringList words = phrase.toLower().split(QRegExp("\\s+"));
+  QStringList words = Tokenizer::fold(phrase).split(QRegExp("\\s+"));
   QSet<int> entries = book->index()->words()->findWords(words, true);
   QList<int> sortedEntries = entries.toList();
   qSort(sortedEntries);
   qDebug () << "immfp" << entries;
 
   QList<SearchResult> results;
-  
-  foreach (int pgno, sortedEntries) {
-    CachedEntry ef(book->entry(pgno));
-    ASSERT(ef);
-    QString ttl = ef->titleText();
-    foreach (TitleData const *bd, ef->children<TitleData>())
-      addToResults(results, phrase, ttl, bd, pgno, pgno);
-    foreach (BlockData const *bd, ef->children<BlockData>())
-      addToResults(results, phrase, ttl, bd, pgno, pgno + bd->sheet());
-    foreach (LateNoteData const *bd, ef.lateNoteManager()->notes())
-      addToResults(results, phrase, ttl, bd, pgno, pgno + bd->sheet());
-  }
+  foreach (int pgno, sortedEntries)
+    results += findInEntry(pgno, phrase);
 
   return results;
 }
 
 void Search::startSearchForPhrase(QString s) {
-  if (isRunning()) {
-    abandon = true;
-    if (!wait(2000)) {
-      qDebug() << "Search: could not stop thread nicely.";
-      terminate();
+  abandonSearch();
+  int gen = generation.load();
+  MetaIndex::Filter filter = MetaIndex::Filter::parse(s);
+  filtering = !filter.isEmpty();
+  allowed.clear();
+  phrase = s;
+  typed = s;
+  results.clear();
+  announced = 0;
+  running = true;
+
+  /* Any entry that contains a phrase also contains every prefix of it,
+     so when the user types on, we need only look at the entries that
+     had the previous phrase. */
+  QString lc = Tokenizer::fold(phrase);
+  QStringList words = lc.split(QRegExp("\\s+"));
+  QList<int> pages;
+  if (filtering) {
+    /* The word index narrows down the entries, then the metadata index
+       tells which of their objects qualify. */
+    if (phrase.trimmed().isEmpty()) {
+      pages = book->index()->phrases()->entries();
+    } else {
+      pages = book->index()->words()->findWords(words, true).toList();
+      qSort(pages);
+    }
+    MetaIndex const *midx = book->index()->meta();
+    QSet<int> keep;
+    for (int id: midx->select(filter, &pages)) {
+      keep.insert(midx->entry(id));
+      allowed.insert(midx->uuid(id));
+    }
+    QList<int> kept;
+    for (int pg: pages)
+      if (keep.contains(pg))
+        kept << pg;
+    pages = kept;
+    ranked = false;
+    rankOf.clear();
+    nCandidates = pages.size();
+  } else if (!refinePhrase.isEmpty() && lc.startsWith(refinePhrase)) {
+    pages = refinePages.toList();
+    qSort(pages);
+    ranked = false;
+    rankOf.clear();
+    nCandidates = pages.size();
+  } else {
+    pages = candidates(words);
+  }
+  if (pages.isEmpty() && fuzzy && !filtering) {
+    QStringList fixed = corrected(words);
+    if (fixed!=words) {
+      phrase = fixed.join(" ");
+      pages = candidates(fixed);
     }
   }
+  if (ranked || filtering || phrase!=typed) {
+    refinePhrase = "";
+    refinePages.clear();
+  } else {
+    refinePhrase = lc;
+    refinePages = pages.toSet();
+  }
 
-  phrase = s;
-  results.clear();
-  abandon = false;
-  start();
+  /* Entries that the phrase index does not know yet have to be loaded,
+     which can only happen here. The rest is farmed out in chunks. */
+  PhraseIndex const *pidx = book->index()->phrases();
+  QList< QList<QByteArray> > chunks;
+  QList<QByteArray> chunk;
+  foreach (int pgno, pages) {
+    if (pidx->contains(pgno)) {
+      chunk << pidx->blockCopy(pgno);
+      if (chunk.size()>=CHUNK_SIZE) {
+        chunks << chunk;
+        chunk.clear();
+      }
+    } else {
+      addResults(findInEntry(pgno, phrase));
+    }
+  }
+  if (!chunk.isEmpty())
+    chunks << chunk;
+
+  { QMutexLocker l(&mutex);
+    tasksLeft = chunks.size();
+  }
+  foreach (QList<QByteArray> const &c, chunks)
+    pool.start(new SearchTask(this, gen, phrase, c));
+  if (!results.isEmpty() || chunks.isEmpty())
+    QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
 }
 
-void Search::abandonSearch() {
-  abandon = true;
+QList<int> Search::candidates(QStringList words) {
+  ranked = false;
+  rankOf.clear();
+  WordIndex *widx = book->index()->words();
+  QList<int> pages;
+  if (rankLimit>0) {
+    for (auto const &r: widx->rankWords(words, rankLimit, true, &nCandidates))
+      pages << r.first;
+    ranked = nCandidates > rankLimit;
+    if (ranked) {
+      for (int n=0; n<pages.size(); n++)
+        rankOf[pages[n]] = n;
+    } else {
+      qSort(pages); // we have them all
+    }
+  } else {
+    pages = widx->findWords(words, true).toList();
+    nCandidates = pages.size();
+    qSort(pages);
+  }
+  return pages;
 }
 
-bool Search::isSearchComplete() {
-  return !isRunning() && !abandon;
+QStringList Search::corrected(QStringList words) const {
+  WordIndex *widx = book->index()->words();
+  for (int n=0; n<words.size(); n++) {
+    bool partial = n==words.size()-1;
+    if (words[n].isEmpty())
+      continue;
+    if (partial ? !widx->findPartialWord(words[n]).isEmpty()
+        : !widx->findWord(words[n]).isEmpty())
+      continue;
+    QStringList alt = widx->fuzzyTerms(words[n]);
+    if (!alt.isEmpty())
+      words[n] = alt.first();
+  }
+  return words;
 }
 
-bool Search::isSearching() {
-  return isRunning();
+void Search::verify(int gen, QString phrase, QList<QByteArray> blocks) {
+  for (QByteArray const &b: blocks) {
+    if (generation.load()!=gen)
+      return;
+    QList<SearchResult> res = PhraseIndex::findInBlock(b, phrase);
+    if (res.isEmpty())
+      continue;
+    QMutexLocker l(&mutex);
+    if (generation.load()!=gen)
+      return;
+    if (pending.isEmpty())
+      QMetaObject::invokeMethod(deliveryTimer, "start", Qt::QueuedConnection);
+    pending += res;
+  }
+  QMutexLocker l(&mutex);
+  if (generation.load()==gen && --tasksLeft==0)
+    QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
 }
 
-QList<SearchResult> Search::searchResults() const {
-  mutex.lock();
-  QList<SearchResult> res = results;
-  mutex.unlock();
-  return res;
+void Search::deliver() {
+  if (!running)
+    return;
+  QList<SearchResult> res;
+  bool done;
+  { QMutexLocker l(&mutex);
+    res = pending;
+    pending.clear();
+    done = tasksLeft==0;
+  }
+  addResults(res);
+  if (results.size() > announced) {
+    announced = results.size();
+    emit resultsFound();
+  }
+  if (done) {
+    if (!refinePhrase.isEmpty()) {
+      /* Now we know exactly which entries have the phrase. */
+      refinePages.clear();
+      for (SearchResult const &r: results)
+        refinePages.insert(r.startPageOfEntry);
+    }
+    running = false;
+    complete = true;
+    emit searchCompleted();
+  }
 }
 
-      
-void Search::run() {
-  QStringList words = phrase.toLower().split(QRegExp("\\s+"));
-  QSet<int> entries = book->index()->words()->findWords(words, true);
+void Search::forgetRefinement() {
+  /* An edited entry may now have a phrase that it did not have before,
+     so the next search cannot be limited to the results of this one. */
+  refinePhrase = "";
+  refinePages.clear();
+}
 
-  foreach (int pgno, entries) {
-    if (abandon)
-      return;
-    CachedEntry ef(book->entry(pgno));
-    QString ttl = ef->titleText();
-    foreach (TitleData const *bd, ef->children<TitleData>()) {
-      mutex.lock();
-      addToResults(results, phrase, ttl, bd, pgno, pgno);
-      mutex.unlock();
-    }
-    foreach (BlockData const *bd, ef->children<BlockData>()) {
-      mutex.lock();
-      addToResults(results, phrase, ttl, bd, pgno, pgno + bd->sheet());
-      mutex.unlock();
-    }
+void Search::addResults(QList<SearchResult> const &res) {
+  if (res.isEmpty())
+    return;
+  if (filtering) {
+    for (SearchResult const &r: res)
+      if (allowed.contains(r.uuid))
+        results << r;
+  } else {
+    results += res;
   }
-  if (!abandon)
-    emit searchCompleted();
+  /* Workers finish out of order, but each entry's results arrive
+     together, so a stable sort by entry keeps them in document order. */
+  QHash<int, int> const &rank = rankOf;
+  if (ranked)
+    std::stable_sort(results.begin(), results.end(),
+                     [&rank](SearchResult const &a, SearchResult const &b) {
+                       return rank.value(a.startPageOfEntry)
+                         < rank.value(b.startPageOfEntry);
+                     });
+  else
+    std::stable_sort(results.begin(), results.end(),
+                     [](SearchResult const &a, SearchResult const &b) {
+                       return a.startPageOfEntry < b.startPageOfEntry;
+                     });
+}
+
+void Search::abandonSearch() {
+  generation.ref();
+  { QMutexLocker l(&mutex);
+    pending.clear();
+    tasksLeft = 0;
+  }
+  deliveryTimer->stop();
+  running = false;
+  complete = false;
+}
+
+bool Search::isSearchComplete() {
+  return complete;
+}
+
+bool Search::isSearching() {
+  return running;
+}
+
+QList<SearchResult> Search::searchResults() const {
+  return results;
 }
@@ -22,39 +22,100 @@
 #define SEARCH_H
 
 #include <QString>
+#include <QStringList>
 #include <QDateTime>
 #include <QList>
-#include <QThread>
+#include <QHash>
+#include <QSet>
+#include <QObject>
 #include <QMutex>
+#include <QAtomicInt>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "Notebook.h"
 #include "SearchResult.h"
 
-class Search: public QThread {
+class Search: public QObject {
+  /* A Search verifies candidate entries from the word index against the
+     phrase index on a pool of threads. Results are collected as they
+     come in and announced in batches through resultsFound(), always on
+     the thread that owns the Search, i.e., the GUI thread.
+     Each search has a generation number. Starting a new search or
+     abandoning the current one bumps the generation, which makes the
+     workers stop at the next candidate; results from older generations
+     are dropped.
+  */
   Q_OBJECT;
 public:
-  Search(Notebook *book);
+  Search(Notebook *book, QObject *parent=0);
   virtual ~Search();
   QList<SearchResult> immediatelyFindPhrase(QString) const;
+  void setRankLimit(int n);
+  /* If more than N entries contain all the words of a phrase,
+     startSearchForPhrase() only considers the N most relevant by BM25,
+     and results come in order of relevance rather than by page. Zero,
+     the default, means always to search everything in page order. */
+  void setFuzzy(bool);
+  /* In fuzzy mode, if no entry contains all the words of a phrase,
+     words that do not occur in the index are replaced by the closest
+     ones that do, and the search is for the corrected phrase. */
   void startSearchForPhrase(QString);
+  /* The phrase may contain metadata filters, as described for
+     MetaIndex::Filter::parse(). If it contains nothing else, all objects
+     that satisfy the filters are found. */
   void abandonSearch();
   bool isSearchComplete();
   bool isSearching();
   QList<SearchResult> searchResults() const;
+  /* All results so far, sorted by page or by relevance. */
+  QString currentPhrase() const { return phrase; }
+  /* In fuzzy mode, this may differ from what was asked for. */
+  QString typedPhrase() const { return typed; }
+  bool isRanked() const { return ranked; }
+  int candidateCount() const { return nCandidates; }
+  /* Number of entries that contain all words of the phrase, whether or
+     not they were all considered. */
 signals:
+  void resultsFound();
+  /* More results are available from searchResults(). */
   void searchCompleted();
+private slots:
+  void deliver();
+  void forgetRefinement();
 private:
-  static void addToResults(QList<SearchResult> &dest, QString phrase,
-                           QString entryTitle,
-                           Data const *data, int entryPage, int dataPage);
-  void run();
-  static QString untable(class TableData const *);
+  QList<SearchResult> findInEntry(int pgno, QString phrase) const;
+  QList<int> candidates(QStringList words);
+  /* Start pages of entries to verify, in the order to report them. Also
+     sets nCandidates, ranked, and rankOf. */
+  QStringList corrected(QStringList words) const;
+  void verify(int gen, QString phrase, QList<QByteArray> blocks);
+  void addResults(QList<SearchResult> const &);
+  friend class SearchTask;
 private:
   Notebook *book;
   QString phrase;
-  QList<SearchResult> results;
-  bool abandon;
-  mutable QMutex mutex;
+  QString typed;
+  bool fuzzy;
+  bool filtering;
+  QSet<QString> allowed; // uuids of objects that satisfy the filter
+  QList<SearchResult> results; // only touched by our own thread
+  int announced; // size of results at last resultsFound()
+  int rankLimit;
+  bool ranked;
+  int nCandidates;
+  QHash<int, int> rankOf; // start page to position in ranking
+  QString refinePhrase; // lowercase phrase of last unranked search, if any
+  QSet<int> refinePages; // superset of the entries that have refinePhrase
+  /* These are forgotten whenever the index changes. */
+  bool running;
+  bool complete;
+  QAtomicInt generation;
+  QThreadPool pool;
+  mutable QMutex mutex; // protects the following
+  QList<SearchResult> pending; // found by workers, not yet delivered
+  int tasksLeft;
+  QTimer *deliveryTimer;
 };
 
 #endif
@@ -27,9 +27,66 @@
 #include "ElnAssert.h"
 #include <QProgressDialog>
 #include "Catalog.h"
+#include "EntryScanner.h"
+#include "EntryProbe.h"
 
 static Data::Creator<TOC> c("toc");
 
+struct ScannedEntry {
+  /* What the TOC needs to know about an entry, as probed on a worker
+     thread. */
+  int page; // as listed in the catalog
+  int startPage; // as stored in the file
+  QString uuid;
+  QString title;
+  int sheetCount;
+  QDateTime created;
+  QDateTime modified;
+};
+
+class TOCScanner: public EntryScanner {
+public:
+  TOCScanner(QString pagesDir):
+    EntryScanner(pagesDir, false), scanned(workerCount()) { }
+  QList<ScannedEntry> results() const {
+    /* In page order */
+    QMap<int, ScannedEntry> all;
+    for (QList<ScannedEntry> const &lst: scanned)
+      for (ScannedEntry const &se: lst)
+        all[se.page] = se;
+    return all.values();
+  }
+protected:
+  virtual bool read(int worker, int pg, QString fn) {
+    EntryProbe probe(fn);
+    if (!probe.ok())
+      return false;
+    ScannedEntry se;
+    se.page = pg;
+    se.startPage = probe.startPage();
+    se.uuid = probe.uuid();
+    se.title = probe.titleText();
+    se.sheetCount = probe.sheetCount();
+    se.created = probe.created();
+    se.modified = probe.modified();
+    scanned[worker] << se;
+    return true;
+  }
+private:
+  QVector<QList<ScannedEntry> > scanned; // one list per worker
+};
+
+static void fillEntry(TOCEntry *e, ScannedEntry const &se) {
+  // Same as TOC::addEntry and TOC::updateEntry
+  e->setStartPage(se.startPage);
+  e->setTitle(se.title);
+  e->setSheetCount(se.sheetCount);
+  e->setUuid(se.uuid);
+  e->setCreated(se.created);
+  e->setModified(se.modified);
+  e->setLastSeen(QDateTime::currentDateTime());
+}
+
 
 static TOC *errorReturn(QString s) {
   QMessageBox mb(QMessageBox::Critical, "Failure to rebuild TOC",
@@ -206,7 +263,17 @@ bool TOC::update(Catalog const &cat) {
   QStringList duplicates_in_directory;
   QList<int> outdated_or_missing_page_in_index;
 
+  /* If the catalog knows what changed since the TOC was last found in
+     agreement with it, only those pages need checking. Entries that
+     went missing without their files changing would go unnoticed, but
+     that shows in the count. */
+  QSet<int> changed = cat.changedPages();
+  bool checkAll = !cat.isIncremental()
+    || pg2file.uniqueKeys().size()!=entries().size();
+
   foreach (int pgno, entries().keys()) {
+    if (!checkAll && !changed.contains(pgno))
+      continue;
     QString uuid = entries()[pgno]->uuid();
     QString fn = uuid.isEmpty()
       ? QString("%1.json").arg(pgno)
@@ -225,7 +292,7 @@ bool TOC::update(Catalog const &cat) {
   }
   QSet<int> seen;
   foreach (int pgno, pg2file.keys()) {
-    if (seen.contains(pgno))
+    if (seen.contains(pgno) || (!checkAll && !changed.contains(pgno)))
       continue;
     seen.insert(pgno);
     QString fn = *pg2file.find(pgno);
@@ -292,7 +359,7 @@ bool TOC::doUpdate(Catalog const &cat,
 
   QProgressDialog mb("Updating table of contents...",
 		     "Cancel", 0,
-		     2 * outdated_or_missing_page_in_index.size());
+		     outdated_or_missing_page_in_index.size());
   mb.setWindowModality(Qt::WindowModal);
   mb.setMinimumDuration(200);
   mb.setValue(0);
@@ -324,19 +391,35 @@ bool TOC::doUpdate(Catalog const &cat,
       entryUuid[pgno] = storeduuid;
     mb.setValue(++k);
   }
-  mb.setMaximum(k + entryUuid.size());
-  for (int pgno: entryUuid.keys()) {
+  mb.close();
+
+  TOCScanner scanner(cat.path());
+  for (int pgno: entryUuid.keys())
+    scanner.add(pgno, entryUuid[pgno]);
+  if (!scanner.run("Updating table of contents..."))
+    return false;
+  for (int pgno: scanner.failed())
+    errorReturn(QString("Failed to load %1-%2.")
+                .arg(pgno).arg(entryUuid[pgno]));
+  for (ScannedEntry const &se: scanner.results()) {
+    TOCEntry *e = find(se.startPage);
+    if (!e) {
+      e = new TOCEntry(this);
+      entries_[se.startPage] = e;
+    }
+    fillEntry(e, se);
+  }
+  for (int pgno: scanner.deferred()) {
     EntryFile *f = ::loadEntry(cat.path(), pgno, entryUuid[pgno], 0);
-    if (f) {
-      if (!updateEntry(f->data()))
-	addEntry(f->data());
-      delete f;
-    } else {
-      delete f;
+    if (!f) {
       errorReturn(QString("Failed to load %1-%2.")
 		  .arg(pgno).arg(entryUuid[pgno]));
+      continue;
     }
-    mb.setValue(++k);
+    if (!updateEntry(f->data()))
+      addEntry(f->data());
+    f->cancelSave(); // leave any journal alone
+    delete f;
   }
   return true;
 }
@@ -410,10 +493,9 @@ void TOC::resolveDuplicates(QMultiMap<int, QString> &pg2file, int pgno,
   for (auto &it: entries)
     it.uuid =  extractUUIDFromFilename(it.fn);
   for (auto &it: entries) {
-    EntryFile *f = EntryFile::load(pages.absoluteFilePath(it.fn), 0);
-    if (f) {
-      it.cre = f->data()->created();
-      delete f;
+    EntryProbe probe(pages.absoluteFilePath(it.fn));
+    if (probe.ok()) {
+      it.cre = probe.created();
     } else {
       QFile fd(pages.absoluteFilePath(it.fn));
       QFileInfo fi(fd);
@@ -477,28 +559,51 @@ TOC *TOC::rebuild(QDir pages) {
 
   resolveDuplicates(pg2file, pages);
 
-  mb.setMaximum(pg2file.keys().size());
-  int k = 0;
-  
-  foreach (int n, pg2file.keys()) {
-    if (mb.wasCanceled()) 
-      return 0;
+  mb.close();
 
+  /* Entries are parsed in parallel. Those whose contents do not match
+     their file names are then loaded again to be corrected, as are
+     those that have a journal. */
+  TOCScanner scanner(pages.absolutePath());
+  QList<int> pgnos = pg2file.uniqueKeys();
+  for (int n: pgnos) {
     if (pg2file.count(n)>1) 
       errorReturn("Duplicate page number: " + QString::number(n));
-   
+    scanner.addFile(n, *pg2file.find(n));
+  }
+  if (!scanner.run("Table of contents found missing or corrupted."
+                   " Attempting to rebuild..."))
+    return 0;
+
+  for (int n: scanner.failed()) {
     QString fn = *pg2file.find(n);
-    EntryFile *f = EntryFile::load(pages.absoluteFilePath(fn), 0);
-    if (!f) {
-      QFile fd(pages.absoluteFilePath(fn));
-      QFileInfo fi(fd);
-      if (fi.exists() && fi.size()>0) {
-	return errorReturn("Failed to load " + fn + ".");
-      } else {
-	fd.remove();
-	continue;
-      }
+    QFile fd(pages.absoluteFilePath(fn));
+    QFileInfo fi(fd);
+    if (fi.exists() && fi.size()>0) 
+      return errorReturn("Failed to load " + fn + ".");
+    else
+      fd.remove();
+  }
+
+  QList<int> reload = scanner.deferred();
+  QRegExp re("^(\\d\\d*)-(.*).json");
+  for (ScannedEntry const &se: scanner.results()) {
+    QString fn = *pg2file.find(se.page);
+    QString namedid = re.exactMatch(fn) ? re.cap(2) : "";
+    if (se.startPage!=se.page || se.uuid!=namedid) {
+      reload << se.page;
+    } else {
+      TOCEntry *e = new TOCEntry(toc);
+      fillEntry(e, se);
+      toc->entries_[se.page] = e;
     }
+  }
+  
+  for (int n: reload) {
+    QString fn = *pg2file.find(n);
+    EntryFile *f = EntryFile::load(pages.absoluteFilePath(fn), 0);
+    if (!f)
+      return errorReturn("Failed to load " + fn + ".");
     bool mustsave = false;
     int m = f->data()->startPage();
     if (m!=n) {
@@ -508,7 +613,6 @@ TOC *TOC::rebuild(QDir pages) {
       mustsave = true;
     }
     QString storedid = f->data()->uuid();
-    QRegExp re("^(\\d\\d*)-(.*).json");
     QString namedid = re.exactMatch(fn) ? re.cap(2) : "";
     
     if (storedid != namedid) {
@@ -523,7 +627,6 @@ TOC *TOC::rebuild(QDir pages) {
     
     toc->addEntry(f->data());
     delete f;
-    mb.setValue(++k);
   }
 
   return toc;
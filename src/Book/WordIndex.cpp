@@ -20,30 +20,709 @@
 #include "EntryFile.h"
 #include "EntryData.h"
 #include "JSONFile.h"
+#include "JSONWriter.h"
+#include "FileWriter.h"
 #include "ElnAssert.h"
-#include "Translate.h"
 #include <QDebug>
-#include <QMessageBox>
-#include <QProgressDialog>
-#include "LateNoteManager.h"
+#include <QtEndian>
+#include <QRunnable>
+#include <QThread>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include <cmath>
+#include "Entry.h"
+#include "EntryScanner.h"
+
+/* The binary index file consists of:
+
+     Header (40 bytes):
+       char[8] magic: "ELNWIDX" followed by a zero byte
+       u32 version (3)
+       u32 nTerms
+       u32 nSeen
+       u32 termPoolSize
+       u32 postPoolSize
+       u32 nPages
+       u32 pagePoolSize
+       u32 reserved (0)
+     Last-seen table: nSeen times
+       i32 startPage, i64 msecsSinceEpoch (UTC)
+     Term table, sorted bytewise by the UTF-8 of the terms: nTerms times
+       u32 termOffset, u32 termLength, u32 postOffset, u32 postCount
+     Page table, sorted by start page: nPages times
+       i32 startPage, u32 termIdOffset, u32 termIdCount, u32 wordCount
+     Term pool: the UTF-8 of all terms
+     Posting pool: for each term, its start pages in ascending order,
+       each stored as the difference from the previous one (the first
+       from zero) in LEB128 varint form, followed by the number of
+       occurrences of the term in that page, also as a varint.
+     Page pool: for each page, the indices into the term table of the
+       terms that occur in it, encoded like the postings.
+
+   All numbers are little-endian. Because the tables are sorted and of
+   fixed stride, a word can be found by binary search without decoding
+   anything else, and so can the words of a page.
+*/
+
+static char const idxMagic[8] = { 'E', 'L', 'N', 'W', 'I', 'D', 'X', 0 };
+static quint32 const idxVersion = 3;
+static int const idxHeaderSize = 40;
+static int const idxSeenSize = 12;
+static int const idxTermSize = 16;
+static int const idxPageSize = 16;
+
+/* BM25 parameters, at their customary values */
+static double const bm25K1 = 1.2;
+static double const bm25B = 0.75;
+
+/* Fuzzy lookup never checks more candidates than this */
+static int const maxFuzzyCandidates = 1000;
+
+static inline quint32 getU32(uchar const *p) {
+  return qFromLittleEndian<quint32>(p);
+}
+
+static inline void putU32(QByteArray &dst, quint32 x) {
+  uchar b[4];
+  qToLittleEndian<quint32>(x, b);
+  dst.append((char const *)b, 4);
+}
+
+static inline void putI64(QByteArray &dst, qint64 x) {
+  uchar b[8];
+  qToLittleEndian<qint64>(x, b);
+  dst.append((char const *)b, 8);
+}
+
+static inline void putVarint(QByteArray &dst, quint32 x) {
+  while (x >= 0x80) {
+    dst += char(0x80 | (x & 0x7f));
+    x >>= 7;
+  }
+  dst += char(x);
+}
+
+static inline quint32 getVarint(uchar const *&p) {
+  /* No bounds checks here; attach() has made sure that every list
+     decodes within its pool. */
+  quint32 x = 0;
+  int shift = 0;
+  uchar b;
+  do {
+    b = *p++;
+    x |= quint32(b & 0x7f) << shift;
+    shift += 7;
+  } while ((b & 0x80) && shift<35);
+  return x;
+}
+
+static bool skipVarints(uchar const *&p, uchar const *end, quint64 n) {
+  /* Returns false if the N varints at P do not end by END, or if any
+     is longer than a u32 needs. */
+  while (n--) {
+    int len = 0;
+    do {
+      if (p>=end || ++len>5)
+        return false;
+    } while (*p++ & 0x80);
+  }
+  return true;
+}
+
+static void putPostings(QByteArray &dst, WordIndex::Postings const &pp) {
+  quint32 prev = 0;
+  for (auto i=pp.begin(); i!=pp.end(); ++i) {
+    putVarint(dst, quint32(i.key()) - prev);
+    putVarint(dst, quint32(i.value()));
+    prev = quint32(i.key());
+  }
+}
+
+static QSet<int> pageSet(WordIndex::Postings const &pp) {
+  QSet<int> s;
+  s.reserve(pp.size());
+  for (auto i=pp.begin(); i!=pp.end(); ++i)
+    s.insert(i.key());
+  return s;
+}
+
+static int totalCount(QHash<QString, int> const &counts) {
+  int n = 0;
+  for (int c: counts)
+    n += c;
+  return n;
+}
+
+static QHash<QString, int> wordCounts(EntryData const *data,
+                                     QList<Data *> const &notes) {
+  // Same as Entry::wordCounts
+  QHash<QString, int> counts;
+  data->countWords(counts);
+  for (Data const *note: notes)
+    note->countWords(counts);
+  return counts;
+}
+
+class PartialIndexer: public EntryScanner {
+  /* For a full build, every worker collects an index of its own, which
+     WordIndex::build merges at the end. */
+public:
+  struct Partial {
+    QHash<QString, WordIndex::Postings> postings;
+    QHash<int, int> lengths;
+  };
+public:
+  PartialIndexer(QString pagesDir):
+    EntryScanner(pagesDir), partials(workerCount()) { }
+protected:
+  virtual void scan(int worker, int pg, EntryData *data,
+                    QList<Data *> const &notes) {
+    add(partials[worker], pg, wordCounts(data, notes));
+  }
+  virtual void scanLoaded(int pg, Entry *entry) {
+    add(partials[0], pg, entry->wordCounts());
+  }
+private:
+  static void add(Partial &p, int pg, QHash<QString, int> const &counts) {
+    for (auto i=counts.begin(); i!=counts.end(); ++i)
+      p.postings[i.key()].insert(pg, i.value());
+    p.lengths[pg] = totalCount(counts);
+  }
+public:
+  QVector<Partial> partials;
+};
+
+class WordCounter: public EntryScanner {
+  /* For an update, the counts per entry are needed, since each entry's
+     old postings must be dropped. */
+public:
+  WordCounter(QString pagesDir):
+    EntryScanner(pagesDir), counted(workerCount()) { }
+protected:
+  virtual void scan(int worker, int pg, EntryData *data,
+                    QList<Data *> const &notes) {
+    counted[worker] << qMakePair(pg, wordCounts(data, notes));
+  }
+  virtual void scanLoaded(int pg, Entry *entry) {
+    counted[0] << qMakePair(pg, entry->wordCounts());
+  }
+public:
+  QVector<QList<QPair<int, QHash<QString, int> > > > counted;
+};
+
+static QVector<quint64> trigramsOf(QString const &word) {
+  /* The word is padded at both ends, so that a word of N characters
+     has N trigrams, and its first and last letters weigh as much as
+     the others. */
+  QString s = QChar(2) + word + QChar(3);
+  QVector<quint64> tt;
+  for (int i=0; i+2<s.size(); i++) {
+    quint64 t = (quint64(s[i].unicode()) << 32)
+      | (quint64(s[i+1].unicode()) << 16) | s[i+2].unicode();
+    if (!tt.contains(t))
+      tt << t;
+  }
+  return tt;
+}
+
+class Trigrams {
+  /* Maps trigrams to indices in TERMS. Words that disappear from the
+     index are left in, and filtered out on lookup. */
+public:
+  QStringList terms;
+  QSet<QString> known;
+  QHash<quint64, QVector<int> > map;
+  void add(QString const &word) {
+    if (known.contains(word))
+      return;
+    int id = terms.size();
+    terms << word;
+    known.insert(word);
+    for (quint64 t: trigramsOf(word))
+      map[t] << id;
+  }
+};
+
+class TrigramBuilder: public QRunnable {
+  /* Builds the trigram index on a worker thread, from copies of the
+     base's term table and term pool plus the words in the overlay, so
+     that it never touches the WordIndex itself. Tells the index through
+     trigramsReady() when it is done. */
+public:
+  TrigramBuilder(QObject *index, int gen, QByteArray termTable,
+                 QByteArray termPool, QStringList extra):
+    index(index), gen(gen), termTable(termTable), termPool(termPool),
+    extra(extra) {
+    setAutoDelete(false);
+  }
+  virtual void run() {
+    QThread::currentThread()->setPriority(QThread::LowestPriority);
+    int n = termTable.size() / idxTermSize;
+    result.terms.reserve(n + extra.size());
+    result.known.reserve(n + extra.size());
+    uchar const *tt = (uchar const *)termTable.constData();
+    for (int k=0; k<n; k++) {
+      uchar const *t = tt + k*idxTermSize;
+      result.add(QString::fromUtf8(termPool.constData() + getU32(t),
+                                   getU32(t+4)));
+    }
+    for (QString const &w: extra)
+      result.add(w);
+    QMetaObject::invokeMethod(index, "trigramsReady", Qt::QueuedConnection,
+                              Q_ARG(int, gen));
+  }
+private:
+  QObject *index;
+  int gen;
+  QByteArray termTable;
+  QByteArray termPool;
+  QStringList extra;
+public:
+  Trigrams result;
+};
+
+static int editDistance(QString const &a, QString const &b, int maxDist) {
+  /* Levenshtein distance, or maxDist+1 if it would exceed maxDist. */
+  int n = a.size();
+  int m = b.size();
+  if (qAbs(n - m) > maxDist)
+    return maxDist + 1;
+  QVector<int> prev(m + 1);
+  QVector<int> cur(m + 1);
+  for (int j=0; j<=m; j++)
+    prev[j] = j;
+  for (int i=1; i<=n; i++) {
+    cur[0] = i;
+    int best = i;
+    for (int j=1; j<=m; j++) {
+      int d = prev[j-1] + (a[i-1]==b[j-1] ? 0 : 1);
+      d = qMin(d, prev[j] + 1);
+      d = qMin(d, cur[j-1] + 1);
+      cur[j] = d;
+      best = qMin(best, d);
+    }
+    if (best > maxDist)
+      return maxDist + 1;
+    prev.swap(cur);
+  }
+  return qMin(prev[m], maxDist + 1);
+}
+
+class PostingCursor {
+  /* Walks the postings of one term in page order, whether they live in
+     the base or in the overlay. */
+public:
+  PostingCursor(uchar const *p, quint32 count):
+    p(p), left(count), size(count), ovl(false), pg(0), cnt(0) {
+    next();
+  }
+  PostingCursor(WordIndex::Postings const &pp):
+    p(0), left(0), size(pp.size()), ovl(true), it(pp.begin()), end(pp.end()),
+    pg(0), cnt(0) {
+    next();
+  }
+  bool atEnd() const { return done; }
+  int page() const { return pg; }
+  int count() const { return cnt; }
+  int df() const { return size; } // number of pages with the term
+  void next() {
+    if (ovl) {
+      done = it==end;
+      if (!done) {
+        pg = it.key();
+        cnt = it.value();
+        ++it;
+      }
+    } else {
+      done = left==0;
+      if (!done) {
+        pg += getVarint(p);
+        cnt = getVarint(p);
+        left--;
+      }
+    }
+  }
+  void seek(int target) {
+    while (!done && pg<target)
+      next();
+  }
+private:
+  uchar const *p;
+  quint32 left;
+  int size;
+  bool ovl;
+  WordIndex::Postings::const_iterator it, end;
+  bool done;
+  int pg;
+  int cnt;
+};
+
+class CursorGroup {
+  /* The union of the postings of several terms, as for a partial word.
+     Counts of terms that share a page are added. */
+public:
+  CursorGroup(QList<PostingCursor> const &cc): cc(cc) { }
+  bool atEnd() const {
+    for (PostingCursor const &c: cc)
+      if (!c.atEnd())
+        return false;
+    return true;
+  }
+  int page() const {
+    int pg = 0;
+    bool any = false;
+    for (PostingCursor const &c: cc) {
+      if (!c.atEnd() && (!any || c.page()<pg)) {
+        pg = c.page();
+        any = true;
+      }
+    }
+    return pg;
+  }
+  int count() const {
+    int pg = page();
+    int n = 0;
+    for (PostingCursor const &c: cc)
+      if (!c.atEnd() && c.page()==pg)
+        n += c.count();
+    return n;
+  }
+  int df() const {
+    int n = 0;
+    for (PostingCursor const &c: cc)
+      n += c.df();
+    return n;
+  }
+  void next() {
+    int pg = page();
+    for (PostingCursor &c: cc)
+      if (!c.atEnd() && c.page()==pg)
+        c.next();
+  }
+  void seek(int target) {
+    for (PostingCursor &c: cc)
+      c.seek(target);
+  }
+private:
+  QList<PostingCursor> cc;
+};
 
 WordIndex::WordIndex(QObject *parent): QObject(parent) {
+  mapped = 0;
+  base = 0;
+  nTerms = 0;
+  nPages = 0;
+  termTable = termPool = postPool = 0;
+  pageTable = pagePool = 0;
+  nDocs = 0;
+  totalLength = 0;
+  trigrams = 0;
+  trigramBuilder = 0;
+  trigramGen = 0;
 }
 
 WordIndex::~WordIndex() {
+  dropTrigrams();
+  detach();
 }
 
-/* Index is saved in json as a map from words to an array of integers. */
+void WordIndex::clear() {
+  detach();
+  overlay.clear();
+  overlayTerms.clear();
+  overlayLengths.clear();
+  lastseen.clear();
+  dropTrigrams();
+}
+
+void WordIndex::detach() {
+  if (mapped) {
+    mapped->close(); // this unmaps
+    delete mapped;
+    mapped = 0;
+  }
+  baseBuffer.clear();
+  base = 0;
+  nTerms = 0;
+  nPages = 0;
+  termTable = termPool = postPool = 0;
+  pageTable = pagePool = 0;
+  nDocs = 0;
+  totalLength = 0;
+}
+
+static bool checkIndex(uchar const *data, qint64 size) {
+  /* Checks that the tables, all offsets, and all posting and page lists
+     are within bounds, so that lookups need not worry. A corrupt file is
+     rejected, and then gets rebuilt. */
+  if (size < idxHeaderSize || memcmp(data, idxMagic, 8)!=0) {
+    qDebug() << "WordIndex: Not an index file";
+    return false;
+  }
+  if (getU32(data + 8) != idxVersion) {
+    qDebug() << "WordIndex: Unknown index version" << getU32(data + 8);
+    return false;
+  }
+  quint32 nt = getU32(data + 12);
+  quint32 ns = getU32(data + 16);
+  quint32 tps = getU32(data + 20);
+  quint32 pps = getU32(data + 24);
+  quint32 np = getU32(data + 28);
+  quint32 pgps = getU32(data + 32);
+  qint64 need = idxHeaderSize + qint64(ns)*idxSeenSize
+    + qint64(nt)*idxTermSize + qint64(np)*idxPageSize
+    + qint64(tps) + pps + pgps;
+  if (size < need) {
+    qDebug() << "WordIndex: Truncated index file";
+    return false;
+  }
+  uchar const *seen = data + idxHeaderSize;
+  uchar const *tt = seen + qint64(ns)*idxSeenSize;
+  uchar const *pgt = tt + qint64(nt)*idxTermSize;
+  uchar const *tp = pgt + qint64(np)*idxPageSize;
+  uchar const *pp = tp + tps;
+  uchar const *pgp = pp + pps;
+  for (quint32 k=0; k<nt; k++) {
+    uchar const *t = tt + k*idxTermSize;
+    bool ok = qint64(getU32(t)) + getU32(t+4) <= tps
+      && getU32(t+8) <= pps;
+    if (ok) {
+      uchar const *p = pp + getU32(t+8);
+      ok = skipVarints(p, pp + pps, 2*quint64(getU32(t+12)));
+    }
+    if (!ok) {
+      qDebug() << "WordIndex: Corrupt index file";
+      return false;
+    }
+  }
+  for (quint32 k=0; k<np; k++) {
+    uchar const *r = pgt + k*idxPageSize;
+    bool ok = getU32(r+4) <= pgps;
+    if (ok) {
+      uchar const *p = pgp + getU32(r+4);
+      ok = skipVarints(p, pgp + pgps, getU32(r+8));
+    }
+    if (!ok) {
+      qDebug() << "WordIndex: Corrupt index file";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool WordIndex::attach(uchar const *data, qint64 size) {
+  if (!checkIndex(data, size))
+    return false;
+  quint32 nt = getU32(data + 12);
+  quint32 ns = getU32(data + 16);
+  quint32 tps = getU32(data + 20);
+  quint32 pps = getU32(data + 24);
+  quint32 np = getU32(data + 28);
+  uchar const *seen = data + idxHeaderSize;
+  uchar const *tt = seen + qint64(ns)*idxSeenSize;
+  uchar const *pgt = tt + qint64(nt)*idxTermSize;
+  uchar const *tp = pgt + qint64(np)*idxPageSize;
+  uchar const *pp = tp + tps;
+  uchar const *pgp = pp + pps;
+
+  lastseen.clear();
+  for (quint32 k=0; k<ns; k++) {
+    uchar const *r = seen + k*idxSeenSize;
+    int pg = qFromLittleEndian<qint32>(r);
+    qint64 ms = qFromLittleEndian<qint64>(r + 4);
+    lastseen[pg] = QDateTime::fromMSecsSinceEpoch(ms);
+  }
+  base = data;
+  nTerms = nt;
+  termTable = tt;
+  termPool = tp;
+  postPool = pp;
+  nPages = np;
+  pageTable = pgt;
+  pagePool = pgp;
+  nDocs = np;
+  totalLength = 0;
+  for (quint32 k=0; k<np; k++)
+    totalLength += getU32(pgt + k*idxPageSize + 12);
+  return true;
+}
 
 bool WordIndex::load(QString filename) {
+  clear();
+  QFile *f = new QFile(filename);
+  if (!f->open(QFile::ReadOnly)) {
+    delete f;
+    return false;
+  }
+  qint64 size = f->size();
+  uchar *data = f->map(0, size);
+  if (data) {
+    mapped = f;
+  } else {
+    // Not all file systems support mapping
+    baseBuffer = f->readAll();
+    delete f;
+    data = (uchar *)baseBuffer.data();
+  }
+  if (!attach(data, size)) {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+QByteArray WordIndex::baseTerm(int k) const {
+  uchar const *t = termTable + k*idxTermSize;
+  return QByteArray::fromRawData((char const *)termPool + getU32(t),
+                                 getU32(t+4));
+}
+
+int WordIndex::lowerBoundTerm(QByteArray const &utf8) const {
+  int lo = 0;
+  int hi = nTerms;
+  while (lo<hi) {
+    int mid = (lo + hi) / 2;
+    if (baseTerm(mid) < utf8)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+int WordIndex::findBaseTerm(QByteArray const &utf8) const {
+  int k = lowerBoundTerm(utf8);
+  if (k<int(nTerms) && baseTerm(k)==utf8)
+    return k;
+  return -1;
+}
+
+WordIndex::Postings WordIndex::basePostings(int k) const {
+  uchar const *t = termTable + k*idxTermSize;
+  uchar const *p = postPool + getU32(t+8);
+  quint32 count = getU32(t+12);
+  Postings pp;
+  quint32 pg = 0;
+  while (count--) {
+    pg += getVarint(p);
+    pp.insert(int(pg), int(getVarint(p)));
+  }
+  return pp;
+}
+
+void WordIndex::addBasePostings(int k, QSet<int> &dst,
+                                QSet<int> const *within) const {
+  uchar const *t = termTable + k*idxTermSize;
+  uchar const *p = postPool + getU32(t+8);
+  quint32 count = getU32(t+12);
+  if (!within)
+    dst.reserve(dst.size() + count);
+  quint32 pg = 0;
+  while (count--) {
+    pg += getVarint(p);
+    getVarint(p); // count
+    if (!within || within->contains(int(pg)))
+      dst.insert(int(pg));
+  }
+}
+
+int WordIndex::findBasePage(int pg) const {
+  int lo = 0;
+  int hi = nPages;
+  while (lo<hi) {
+    int mid = (lo + hi) / 2;
+    if (qFromLittleEndian<qint32>(pageTable + mid*idxPageSize) < pg)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo>=int(nPages)
+      || qFromLittleEndian<qint32>(pageTable + lo*idxPageSize) != pg)
+    return -1;
+  return lo;
+}
+
+QList<int> WordIndex::basePageTerms(int pg) const {
+  QList<int> ids;
+  int idx = findBasePage(pg);
+  if (idx<0)
+    return ids;
+  uchar const *r = pageTable + idx*idxPageSize;
+  uchar const *p = pagePool + getU32(r+4);
+  quint32 count = getU32(r+8);
+  quint32 k = 0;
+  while (count--) {
+    k += getVarint(p);
+    if (k < nTerms)
+      ids << int(k);
+  }
+  return ids;
+}
+
+int WordIndex::documentLength(int pg) const {
+  auto it = overlayLengths.find(pg);
+  if (it!=overlayLengths.end())
+    return it.value();
+  int idx = findBasePage(pg);
+  return idx>=0 ? int(getU32(pageTable + idx*idxPageSize + 12)) : -1;
+}
+
+void WordIndex::setDocumentLength(int pg, int len) {
+  int old = documentLength(pg);
+  if (old>=0) {
+    nDocs--;
+    totalLength -= old;
+  }
+  if (len>=0) {
+    nDocs++;
+    totalLength += len;
+  }
+  overlayLengths[pg] = len;
+}
+
+WordIndex::Postings &WordIndex::overlaid(QString const &word) {
+  auto it = overlay.find(word);
+  if (it!=overlay.end())
+    return it.value();
+  int k = findBaseTerm(word.toUtf8());
+  Postings pp;
+  if (k>=0) {
+    pp = basePostings(k);
+    for (auto i=pp.begin(); i!=pp.end(); ++i)
+      overlayTerms[i.key()].insert(word);
+  }
+  return overlay.insert(word, pp).value();
+}
+
+void WordIndex::addPosting(QString const &word, int pg, int count) {
+  overlaid(word).insert(pg, count);
+  overlayTerms[pg].insert(word);
+  addTrigramTerm(word);
+}
+
+void WordIndex::removePosting(QString const &word, int pg) {
+  Postings &set = overlaid(word);
+  set.remove(pg);
+  auto it = overlayTerms.find(pg);
+  if (it!=overlayTerms.end()) {
+    it.value().remove(word);
+    if (it.value().isEmpty())
+      overlayTerms.erase(it);
+  }
+  if (set.isEmpty() && findBaseTerm(word.toUtf8())<0)
+    overlay.remove(word); // no need to keep it as a tombstone
+}
+
+bool WordIndex::loadJSON(QString filename) {
   bool ok;
   QVariantMap idx = JSONFile::load(filename, &ok);
   if (!ok)
     return false;
 
+  clear();
   if (idx.contains("vsn no")) {
     buildIndex(idx["index"].toMap());
-    lastseen.clear();
     QVariantMap ls(idx["ls"].toMap());
     for (QVariantMap::iterator i = ls.begin(); i!=ls.end(); i++) {
       int pg = i.key().toInt();
@@ -51,7 +730,6 @@ bool WordIndex::load(QString filename) {
       lastseen[pg] = dt;
     }     
   } else {
-    lastseen.clear();
     buildIndex(idx);
   }
 
@@ -59,121 +737,254 @@ bool WordIndex::load(QString filename) {
 }
 
 void WordIndex::buildIndex(QVariantMap const &idx) {
-  index.clear();
+  overlay.clear();
+  overlayTerms.clear();
+  overlayLengths.clear();
 
   for (auto i = idx.begin(); i!=idx.end(); i++) {
     QString w = i.key();
     QVariantList lst = i.value().toList();
-    for (QVariantList::iterator j = lst.begin(); j!=lst.end(); j++) {
-      int pg = (*j).toInt();
-      index[w].insert(pg);
-    }
+    for (QVariantList::iterator j = lst.begin(); j!=lst.end(); j++) 
+      addPosting(w, (*j).toInt());
   }
+
+  /* The old format has no counts, so we pretend that each word occurs
+     once. Entries get their true counts when next saved or updated. */
+  for (auto i = overlayTerms.begin(); i!=overlayTerms.end(); ++i)
+    setDocumentLength(i.key(), i.value().size());
 }
 
-bool WordIndex::save(QString filename) {
-  QVariantMap idx;
-  for (auto i = index.begin(); i!=index.end(); i++) {
-    QString w = i.key();
-    QVariantList lst;
-    foreach (int n, i.value())
-      lst.append(QVariant(n));
-    idx[w] = QVariant(lst);
+QByteArray WordIndex::encode() const {
+  /* Base and overlay are merged in term order. Terms that only occur in
+     the base have their postings copied verbatim, though we do need to
+     decode them to build the page table. */
+  QList< QPair<QByteArray, QString> > ovl;
+  for (auto i = overlay.begin(); i!=overlay.end(); ++i)
+    ovl << QPair<QByteArray, QString>(i.key().toUtf8(), i.key());
+  std::sort(ovl.begin(), ovl.end());
+
+  QByteArray table;
+  QByteArray terms;
+  QByteArray posts;
+  QMap<int, QList<quint32> > pageTerms;
+  quint32 nt = 0;
+  auto addTerm = [&](QByteArray const &term, quint32 count) {
+    putU32(table, terms.size());
+    putU32(table, term.size());
+    putU32(table, posts.size());
+    putU32(table, count);
+    terms += term;
+    nt++;
+  };
+  
+  int k = 0;
+  int j = 0;
+  while (k<int(nTerms) || j<ovl.size()) {
+    QByteArray bt = k<int(nTerms) ? baseTerm(k) : QByteArray();
+    if (j<ovl.size() && (k>=int(nTerms) || !(bt < ovl[j].first))) {
+      // Overlay term, which may replace a base term
+      if (k<int(nTerms) && bt==ovl[j].first)
+        k++;
+      Postings pp = overlay.value(ovl[j].second);
+      if (!pp.isEmpty()) {
+        for (auto i=pp.begin(); i!=pp.end(); ++i)
+          pageTerms[i.key()] << nt;
+        addTerm(ovl[j].first, pp.size());
+        putPostings(posts, pp);
+      }
+      j++;
+    } else {
+      uchar const *t = termTable + k*idxTermSize;
+      quint32 count = getU32(t+12);
+      uchar const *p0 = postPool + getU32(t+8);
+      uchar const *p = p0;
+      quint32 pg = 0;
+      for (quint32 n=0; n<count; n++) {
+        pg += getVarint(p);
+        getVarint(p); // count
+        pageTerms[int(pg)] << nt;
+      }
+      addTerm(bt, count);
+      posts.append((char const *)p0, p - p0);
+      k++;
+    }
   }
 
-  QVariantMap ls;
-  // qDebug() << "Saving index. sizeof lastseen is" << lastseen.size();
-  for (auto i=lastseen.begin(); i!=lastseen.end(); i++) {
-    int pgno = i.key();
-    QDateTime dt = i.value();
-    ls[QString::number(pgno)] = QVariant(dt);
+  /* Pages without any words still need their length recorded, lest
+     they drop out of the document count. */
+  QMap<int, int> lengths;
+  for (quint32 k=0; k<nPages; k++) {
+    uchar const *r = pageTable + k*idxPageSize;
+    lengths[qFromLittleEndian<qint32>(r)] = getU32(r+12);
   }
+  for (auto i=overlayLengths.begin(); i!=overlayLengths.end(); ++i) {
+    if (i.value()>=0)
+      lengths[i.key()] = i.value();
+    else
+      lengths.remove(i.key());
+  }
+  for (auto i=pageTerms.begin(); i!=pageTerms.end(); ++i)
+    if (!lengths.contains(i.key()))
+      lengths[i.key()] = i.value().size();
 
-  QVariantMap top;
-  top["vsn no"] = 1;
-  top["index"] = idx;
-  top["ls"] = ls;
-  
-  return JSONFile::save(top, filename, true);
+  // Term indices were added in increasing order, so they are sorted
+  QByteArray pgtable;
+  QByteArray pgpool;
+  for (auto i=lengths.begin(); i!=lengths.end(); ++i) {
+    QList<quint32> ids = pageTerms.value(i.key());
+    putU32(pgtable, quint32(i.key()));
+    putU32(pgtable, pgpool.size());
+    putU32(pgtable, ids.size());
+    putU32(pgtable, quint32(i.value()));
+    quint32 prev = 0;
+    for (quint32 id: ids) {
+      putVarint(pgpool, id - prev);
+      prev = id;
+    }
+  }
+
+  QByteArray out;
+  out.reserve(idxHeaderSize + lastseen.size()*idxSeenSize
+              + table.size() + pgtable.size()
+              + terms.size() + posts.size() + pgpool.size());
+  out.append(idxMagic, 8);
+  putU32(out, idxVersion);
+  putU32(out, nt);
+  putU32(out, lastseen.size());
+  putU32(out, terms.size());
+  putU32(out, posts.size());
+  putU32(out, lengths.size());
+  putU32(out, pgpool.size());
+  putU32(out, 0);
+  for (auto i=lastseen.begin(); i!=lastseen.end(); ++i) {
+    putU32(out, quint32(i.key()));
+    putI64(out, i.value().toMSecsSinceEpoch());
+  }
+  out += table;
+  out += pgtable;
+  out += terms;
+  out += posts;
+  out += pgpool;
+  return out;
+}
+
+bool WordIndex::save(QString filename) {
+  /* After saving, we query the freshly encoded data rather than the old
+     mapping, which also means that the file is not mapped while the
+     FileWriter replaces it. */
+  QByteArray bin = encode();
+  if (!checkIndex((uchar const *)bin.constData(), bin.size())) {
+    qDebug() << "WordIndex: Failed to encode index";
+    return false; // keeping what we have
+  }
+  detach();
+  overlay.clear();
+  overlayTerms.clear();
+  overlayLengths.clear();
+  baseBuffer = bin;
+  attach((uchar const *)baseBuffer.constData(), baseBuffer.size());
+  FileWriter::instance()->write(filename, bin, FileWriter::ReplaceBinary);
+  return true;
 }
 
 bool WordIndex::build(class TOC *toc, QString pagesDir) {
-  QProgressDialog mb("Search index found missing or corrupted."
-                     " Rebuilding...", "Cancel",
-                     0, toc->newPageNumber());
-  mb.setWindowModality(Qt::WindowModal);
-  mb.setMinimumDuration(200);
-  mb.setValue(0);
-  
-  index.clear();
-  QStringList warns;
-  foreach (int pg, toc->entries().keys()) {
-    if (mb.wasCanceled())
-      return false;
-    QString uuid = toc->tocEntry(pg)->uuid();
-    EntryFile *f = ::loadEntry(pagesDir, pg, uuid, 0);
-    if (f) {
-      Entry *entry = new Entry(f);
-      entry->lateNoteManager()->ensureLoaded();
-      for (QString w: entry->wordSet())
-        index[w].insert(pg);
-      delete entry;
-    } else {
-      qDebug() << "WordIndex::build - Cannot load entry" << pg << uuid;
-      warns << QString("%1").arg(pg);
-    }
-    lastseen[pg] = QDateTime::currentDateTime();
-    qDebug() << "lastseen " << pg << lastseen[pg];
-    mb.setValue(pg);
-  } 
-  mb.close();
-  if (!warns.isEmpty())
-    QMessageBox::warning(0, Translate::_("eln"),
-                         "The following pages could not be loaded"
-                         " while rebuilding the search index: "
-                         + warns.join(", ") + ".", QMessageBox::Close);
+  clear();
+  PartialIndexer scanner(pagesDir);
+  for (TOCEntry const *entry: toc->entries())
+    scanner.add(entry->startPage(), entry->uuid());
+  if (!scanner.run("Search index found missing or corrupted."
+                   " Rebuilding..."))
+    return false;
+  scanner.scanDeferred("while rebuilding the search index");
+
+  for (PartialIndexer::Partial const &p: scanner.partials) {
+    mergePostings(p.postings);
+    for (auto i=p.lengths.begin(); i!=p.lengths.end(); ++i)
+      setDocumentLength(i.key(), i.value());
+  }
+  QDateTime now = QDateTime::currentDateTime();
+  for (int pg: toc->entries().keys())
+    lastseen[pg] = now;
   return true;
 }
 
-void WordIndex::rebuildEntry(int startPage, QSet<QString> newset,
-                             QSet<QString> *oldset) {
-  lastseen[startPage] = QDateTime::currentDateTime();
-  
-  if (oldset) {
-    QSet<QString> dropped = *oldset - newset;
-    QSet<QString> added = newset - *oldset;
-    foreach (QString w, dropped) {
-      index[w].remove(startPage);
-      if (index[w].isEmpty())
-        index.remove(w);
-    }
-    foreach (QString w, added)
-      index[w].insert(startPage);
+void WordIndex::mergePostings(QHash<QString, Postings> const &pp) {
+  for (auto i=pp.begin(); i!=pp.end(); ++i) {
+    Postings &dst = overlaid(i.key());
+    for (auto j=i.value().begin(); j!=i.value().end(); ++j) {
+      dst.insert(j.key(), j.value());
+      overlayTerms[j.key()].insert(i.key());
+    }
+    addTrigramTerm(i.key());
+  }
+}
+
+void WordIndex::rebuildEntry(int startPage,
+                             QHash<QString, int> const &newcounts,
+                             QHash<QString, int> const *oldcounts) {
+  if (oldcounts) {
+    for (auto i=oldcounts->begin(); i!=oldcounts->end(); ++i)
+      if (!newcounts.contains(i.key()))
+        removePosting(i.key(), startPage);
+    for (auto i=newcounts.begin(); i!=newcounts.end(); ++i)
+      if (oldcounts->value(i.key())!=i.value())
+        addPosting(i.key(), startPage, i.value());
   } else {
     dropEntry(startPage);
-    for (QString w: newset)
-      index[w].insert(startPage);
+    for (auto i=newcounts.begin(); i!=newcounts.end(); ++i)
+      addPosting(i.key(), startPage, i.value());
   }
+  // after dropEntry!
+  setDocumentLength(startPage, totalCount(newcounts));
+  lastseen[startPage] = QDateTime::currentDateTime();
 }
 
 void WordIndex::dropEntry(int startPage) {
+  /* Only the page's own terms are visited: those in the overlay through
+     overlayTerms, and those only in the base through its page table. */
   lastseen.remove(startPage);
-  for (QSet<int> &set: index)
-    set.remove(startPage);
+  setDocumentLength(startPage, -1);
+  for (QString const &w: overlayTerms.value(startPage))
+    removePosting(w, startPage);
+  for (int k: basePageTerms(startPage)) {
+    QString w = QString::fromUtf8(baseTerm(k));
+    if (!overlay.contains(w))
+      removePosting(w, startPage);
+  }
 }
 
 QSet<int> WordIndex::findWord(QString word) {
-  if (index.contains(word))
-    return index[word];
-  else
-    return QSet<int>();
+  auto it = overlay.find(word);
+  if (it!=overlay.end())
+    return pageSet(it.value());
+  int k = findBaseTerm(word.toUtf8());
+  QSet<int> s;
+  if (k>=0)
+    addBasePostings(k, s);
+  return s;
 }
 
-QSet<int> WordIndex::findPartialWord(QString wordbit) {
+QSet<int> WordIndex::findPartialWord(QString wordbit,
+                                     QSet<int> const *within) {
+  /* Words that share a prefix are contiguous in both the overlay and the
+     base, so we only visit the matching range of each. */
   QSet<int> s;
-  for (auto i = index.begin(); i!=index.end(); ++i)
-    if (i.key().startsWith(wordbit))
-      s |= i.value();
+  for (auto i = overlay.lowerBound(wordbit);
+       i!=overlay.end() && i.key().startsWith(wordbit); ++i) {
+    for (auto j=i.value().begin(); j!=i.value().end(); ++j)
+      if (!within || within->contains(j.key()))
+        s.insert(j.key());
+  }
+  QByteArray bit = wordbit.toUtf8();
+  for (int k=lowerBoundTerm(bit); k<int(nTerms); k++) {
+    if (within && s.size()==within->size())
+      break; // nothing more to find
+    QByteArray term = baseTerm(k);
+    if (!term.startsWith(bit))
+      break;
+    if (!overlay.contains(QString::fromUtf8(term)))
+      addBasePostings(k, s, within);
+  }
   return s;
 }
 
@@ -182,62 +993,275 @@ QSet<int> WordIndex::findWords(QStringList words, bool lastPartial) {
   if (words.isEmpty())
     return s;
 
-  QString w = words.takeLast();
+  QString last = words.takeLast();
+  if (words.isEmpty())
+    return lastPartial ? findPartialWord(last) : findWord(last);
+
+  /* Complete words first: their postings are short, and once we have
+     their intersection, the prefix range need only be checked against
+     it rather than united in full. */
+  s = findWord(words.takeFirst());
+  foreach (QString w, words) {
+    if (s.isEmpty())
+      return s;
+    s &= findWord(w);
+  }
+  if (s.isEmpty())
+    return s;
   if (lastPartial)
-    s = findPartialWord(w);
+    return findPartialWord(last, &s);
   else
-    s = findWord(w);
+    return s & findWord(last);
+}
 
-  foreach (w, words) 
-    s &= findWord(w);
+QList<PostingCursor> WordIndex::cursors(QString word, bool partial) const {
+  QList<PostingCursor> cc;
+  if (!partial) {
+    auto it = overlay.find(word);
+    if (it!=overlay.end()) {
+      if (!it.value().isEmpty())
+        cc << PostingCursor(it.value());
+    } else {
+      int k = findBaseTerm(word.toUtf8());
+      if (k>=0) {
+        uchar const *t = termTable + k*idxTermSize;
+        cc << PostingCursor(postPool + getU32(t+8), getU32(t+12));
+      }
+    }
+    return cc;
+  }
+  for (auto i = overlay.lowerBound(word);
+       i!=overlay.end() && i.key().startsWith(word); ++i)
+    if (!i.value().isEmpty())
+      cc << PostingCursor(i.value());
+  QByteArray bit = word.toUtf8();
+  for (int k=lowerBoundTerm(bit); k<int(nTerms); k++) {
+    QByteArray term = baseTerm(k);
+    if (!term.startsWith(bit))
+      break;
+    if (!overlay.contains(QString::fromUtf8(term))) {
+      uchar const *t = termTable + k*idxTermSize;
+      cc << PostingCursor(postPool + getU32(t+8), getU32(t+12));
+    }
+  }
+  return cc;
+}
 
-  return s;
+QList< QPair<int, double> > WordIndex::rankWords(QStringList words, int k,
+                                                 bool lastPartial,
+                                                 int *nMatches) const {
+  /* Document-at-a-time: the postings of all words are walked in step,
+     and each page that has all of them is scored right away. Only the
+     best K are kept, in a min-heap, so the full set of matches is never
+     built. */
+  if (nMatches)
+    *nMatches = 0;
+  QList< QPair<int, double> > res;
+  if (words.isEmpty() || k<=0)
+    return res;
+
+  QList<CursorGroup> groups;
+  for (int n=0; n<words.size(); n++)
+    groups << CursorGroup(cursors(words[n],
+                                  lastPartial && n==words.size()-1));
+
+  double N = qMax(nDocs, 1);
+  double avgdl = qMax(double(totalLength) / N, 1.0);
+  QList<double> idf;
+  for (CursorGroup const &g: groups) {
+    double df = qMin(double(g.df()), N);
+    idf << log(1 + (N - df + .5) / (df + .5));
+  }
+
+  typedef std::pair<double, int> Scored; // score and negated page
+  std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored> > heap;
+  int matches = 0;
+  while (true) {
+    int target = 0;
+    bool done = false;
+    for (CursorGroup const &g: groups) {
+      if (g.atEnd()) {
+        done = true;
+        break;
+      }
+      target = qMax(target, g.page());
+    }
+    if (done)
+      break;
+    bool agree = true;
+    for (CursorGroup &g: groups) {
+      g.seek(target);
+      if (g.atEnd()) {
+        done = true;
+        break;
+      }
+      if (g.page()!=target)
+        agree = false;
+    }
+    if (done)
+      break;
+    if (!agree)
+      continue;
+
+    matches++;
+    int dl = documentLength(target);
+    double norm = bm25K1 * (1 - bm25B + bm25B * (dl>=0 ? dl : avgdl) / avgdl);
+    double score = 0;
+    for (int n=0; n<groups.size(); n++) {
+      double tf = groups[n].count();
+      score += idf[n] * tf * (bm25K1 + 1) / (tf + norm);
+      groups[n].next();
+    }
+    heap.push(Scored(score, -target));
+    if (int(heap.size()) > k)
+      heap.pop();
+  }
+
+  if (nMatches)
+    *nMatches = matches;
+  while (!heap.empty()) {
+    res.prepend(QPair<int, double>(-heap.top().second, heap.top().first));
+    heap.pop();
+  }
+  return res;
 }
 
 bool WordIndex::update(TOC const *toc, QString pagesDir) {
-  QList<TOCEntry const *> todo;
+  WordCounter scanner(pagesDir);
+  int n = 0;
   for (TOCEntry const *entry: toc->entries()) {
     int pg = entry->startPage();
     QDateTime mod = entry->modified();
-    if (!lastseen.contains(pg) || mod>lastseen[pg].addSecs(10))
-      todo << entry;
+    if (!lastseen.contains(pg) || mod>lastseen[pg].addSecs(10)) {
+      scanner.add(pg, entry->uuid());
+      n++;
+    }
   }
   
-  if (todo.isEmpty())
+  if (n==0)
     return false;
 
-  QProgressDialog mb("Updating search index...", "Cancel",
-                     0, todo.size());
-  mb.setWindowModality(Qt::WindowModal);
-  mb.setMinimumDuration(200);
-
-  int k = 0;
-  QStringList warns;
-  for (TOCEntry const *entry: todo) {
-    if (mb.wasCanceled())
-      return k>0;
-    int pgno = entry->startPage();
-    QString uuid = entry->uuid();
-    EntryFile *f = ::loadEntry(pagesDir, pgno, uuid, 0);
-    if (f) {
-      for (QString w: f->data()->wordSet())
-        index[w].insert(pgno);
-      delete f;
-      lastseen[pgno] = QDateTime::currentDateTime();
-    } else {
-      qDebug() << "WordIndex::update - Cannot load entry" << pgno << uuid;
-      warns << QString("%1").arg(pgno);
+  bool complete = scanner.run("Updating search index...");
+  if (complete)
+    scanner.scanDeferred("while updating the search index");
+  /* Even if canceled, whatever was scanned is worth keeping. */
+  bool changed = false;
+  for (auto const &counted: scanner.counted) {
+    for (auto const &pc: counted) {
+      rebuildEntry(pc.first, pc.second);
+      changed = true;
     }
-    mb.setValue(++k);
   }
-  mb.close();
-  if (!warns.isEmpty())
-    QMessageBox::warning(0, Translate::_("eln"),
-                         "The following pages could not be loaded"
-                         " while updating the search index: "
-                         + warns.join(", ") + ".", QMessageBox::Close);
-  return true;
+  return complete || changed;
 }
-  
 
-    
+bool WordIndex::hasTerm(QString const &word) const {
+  auto it = overlay.find(word);
+  if (it!=overlay.end())
+    return !it.value().isEmpty();
+  return findBaseTerm(word.toUtf8())>=0;
+}
+
+void WordIndex::addTrigramTerm(QString const &word) {
+  if (trigrams)
+    trigrams->add(word);
+  else if (trigramBuilder)
+    trigramBacklog << word;
+}
+
+void WordIndex::prepareFuzzy() {
+  if (trigrams || trigramBuilder)
+    return;
+  /* The builder gets copies of the terms, because the base may be
+     remapped by save() while it runs. */
+  QByteArray tt, tp;
+  if (nTerms) {
+    tt = QByteArray((char const *)termTable, nTerms*idxTermSize);
+    tp = QByteArray((char const *)termPool, getU32(base + 20));
+  }
+  QStringList extra;
+  for (auto i=overlay.begin(); i!=overlay.end(); ++i)
+    if (!i.value().isEmpty())
+      extra << i.key();
+  trigramBuilder = new TrigramBuilder(this, trigramGen, tt, tp, extra);
+  trigramPool.start(trigramBuilder);
+}
+
+void WordIndex::trigramsReady(int gen) {
+  if (gen==trigramGen && trigramBuilder)
+    adoptTrigrams();
+}
+
+void WordIndex::adoptTrigrams() {
+  trigramPool.waitForDone();
+  trigrams = new Trigrams(trigramBuilder->result);
+  delete trigramBuilder;
+  trigramBuilder = 0;
+  for (QString const &w: trigramBacklog)
+    trigrams->add(w);
+  trigramBacklog.clear();
+}
+
+void WordIndex::dropTrigrams() {
+  trigramGen++;
+  if (trigramBuilder) {
+    trigramPool.waitForDone();
+    delete trigramBuilder;
+    trigramBuilder = 0;
+  }
+  delete trigrams;
+  trigrams = 0;
+  trigramBacklog.clear();
+}
+
+QStringList WordIndex::fuzzyTerms(QString word, int maxDist) {
+  /* A single edit destroys at most three trigrams, so a word within
+     distance D of ours shares at least N-3D of our N trigrams. We only
+     look at words that share at least one, and check the most similar
+     ones first. */
+  if (!trigrams) {
+    prepareFuzzy();
+    adoptTrigrams();
+  }
+  int n = word.size();
+  int dmax = qMin(maxDist, n<=2 ? 0 : n<=5 ? 1 : 2);
+  QVector<quint64> tt = trigramsOf(word);
+  int minShared = qMax(1, tt.size() - 3*dmax);
+
+  QVector<uchar> shared(trigrams->terms.size(), 0);
+  QVector<int> touched;
+  for (quint64 t: tt) {
+    auto it = trigrams->map.find(t);
+    if (it==trigrams->map.end())
+      continue;
+    for (int id: it.value()) {
+      if (shared[id]==0)
+        touched << id;
+      if (shared[id]<255)
+        shared[id]++;
+    }
+  }
+
+  QList< QPair<int, int> > cands; // negated shared count and id
+  for (int id: touched)
+    if (shared[id]>=minShared
+        && qAbs(trigrams->terms[id].size() - n) <= dmax)
+      cands << QPair<int, int>(-shared[id], id);
+  std::sort(cands.begin(), cands.end());
+  if (cands.size() > maxFuzzyCandidates)
+    cands = cands.mid(0, maxFuzzyCandidates);
+
+  QList< QPair< QPair<int, int>, QString > > hits; // (dist, -df), word
+  for (auto const &c: cands) {
+    QString const &w = trigrams->terms[c.second];
+    int d = editDistance(word, w, dmax);
+    if (d<=dmax && hasTerm(w))
+      hits << QPair< QPair<int, int>, QString >
+        (QPair<int, int>(d, -findWord(w).size()), w);
+  }
+  std::sort(hits.begin(), hits.end());
+  QStringList res;
+  for (auto const &h: hits)
+    res << h.second;
+  return res;
+}
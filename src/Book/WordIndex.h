@@ -21,33 +21,140 @@
 #include <QObject>
 #include <QMap>
 #include <QSet>
+#include <QHash>
 #include <QDateTime>
 #include <QVariant>
+#include <QFile>
+#include <QVector>
+#include <QStringList>
+#include <QThreadPool>
 
 class WordIndex: public QObject {
+  /* The index lives mostly in a binary file (see WordIndex.cpp for the
+     format), which is memory-mapped and queried in place. Changes since
+     the last save are kept in an in-memory overlay of complete posting
+     lists, which takes precedence over the file. Saving merges the two.
+     Along with the pages that contain each word, the index records how
+     often the word occurs there, and how many words each page has, so
+     that results can be ranked by BM25.
+   */
   Q_OBJECT;
+public:
+  typedef QMap<int, int> Postings;
+  /* Maps start pages to the number of times a word occurs in them. */
 public:
   WordIndex(QObject *parent=0);
   virtual ~WordIndex();
   bool load(QString filename);
+  /* Loads (maps) a binary index. Returns false if the file is missing,
+     of an unknown version, or corrupt. */
+  bool loadJSON(QString filename);
+  /* Loads an index in the old json format, for migration. */
   bool save(QString filename);
+  /* The actual writing happens on the FileWriter thread. */
   bool build(class TOC *toc, QString pagesDir);
   /* Returns true unless canceled by user. */
-  void rebuildEntry(int startPage, QSet<QString> newset,
-                    QSet<QString> *oldset=0);
+  void rebuildEntry(int startPage, QHash<QString, int> const &newcounts,
+                    QHash<QString, int> const *oldcounts=0);
+  /* NEWCOUNTS maps the words of the entry to their numbers of
+     occurrences, as from Entry::wordCounts(). If OLDCOUNTS is given, only
+     the differences are applied. */
   void dropEntry(int startPage);
   QSet<int> findWord(QString word);
-  QSet<int> findPartialWord(QString wordbit); // must match at beginning of word
+  QSet<int> findPartialWord(QString wordbit, QSet<int> const *within=0);
+  /* Matches at the beginning of words. If WITHIN is given, only pages in
+     it are returned; that is much cheaper than intersecting afterwards. */
   QSet<int> findWords(QStringList words, bool lastPartial=false);
   /* Returned integers are start pages of entries */
+  QList< QPair<int, double> > rankWords(QStringList words, int k,
+                                        bool lastPartial=false,
+                                        int *nMatches=0) const;
+  /* Finds the same entries as findWords(), but returns only the K best
+     by BM25 score, best first, as pairs of start page and score. The
+     total number of matching entries is stored in NMATCHES. */
+  int documentLength(int pg) const; // number of words; -1 if unknown
+  QStringList fuzzyTerms(QString word, int maxDist=2);
+  /* Returns the words in the index that are within edit distance MAXDIST
+     of WORD, closest first, and among equally close ones, the most
+     common first. Short words are allowed fewer edits, and only a
+     bounded number of candidates from the trigram index is checked, so
+     this is cheap even for large dictionaries. WORD itself is included
+     if it occurs. */
+  void prepareFuzzy();
+  /* Starts building the trigram index for fuzzyTerms() on a worker
+     thread. Otherwise, the first call to fuzzyTerms() has to build it,
+     which takes a while for a large dictionary. */
   QDateTime lastSeen(int pg) const;
   bool update(class TOC const *, QString pgdir); // true if changed
+private slots:
+  void trigramsReady(int gen);
 private:
   void buildIndex(QVariantMap const &idx);
+  void clear();
+  bool attach(uchar const *data, qint64 size);
+  void detach();
+  int lowerBoundTerm(QByteArray const &utf8) const;
+  /* Index of the first base term not less than UTF8. */
+  int findBaseTerm(QByteArray const &utf8) const; // -1 if not found
+  QByteArray baseTerm(int k) const; // not a deep copy
+  Postings basePostings(int k) const;
+  void addBasePostings(int k, QSet<int> &dst,
+                       QSet<int> const *within=0) const;
+  int findBasePage(int pg) const; // index into page table, or -1
+  QList<int> basePageTerms(int pg) const;
+  /* Indices of the base terms that occur in page PG. */
+  Postings &overlaid(QString const &word);
+  /* Returns the postings for WORD in the overlay, copying them from
+     the base first if need be. */
+  void addPosting(QString const &word, int pg, int count=1);
+  /* Also replaces the count if WORD was already posted for PG. */
+  void removePosting(QString const &word, int pg);
+  /* These keep overlayTerms in sync and prune empty terms. */
+  void setDocumentLength(int pg, int len);
+  /* Also keeps nDocs and totalLength up to date. LEN = -1 forgets PG. */
+  void mergePostings(QHash<QString, Postings> const &);
+  /* Adds postings for pages that are not yet in the index. */
+  QList<class PostingCursor> cursors(QString word, bool partial) const;
+  /* One cursor per term that is WORD or, if PARTIAL, starts with it.
+     The cursors point into the index, so they are only good until it
+     changes. */
+  bool hasTerm(QString const &word) const;
+  /* True if WORD still has postings. */
+  void addTrigramTerm(QString const &word);
+  /* Adds WORD to the trigram index, or queues it for the index that is
+     being built. Does nothing if neither exists. */
+  void adoptTrigrams();
+  /* Waits for the builder, if need be, and takes over its results. */
+  void dropTrigrams(); // when the index is replaced wholesale
+  QByteArray encode() const;
 private:
-  QMap< QString, QSet<int> > index;
-  /* Maps words to sets of start pages */
+  QFile *mapped; // non-null while the base is memory-mapped
+  QByteArray baseBuffer; // holds the base when it is not mapped
+  uchar const *base;
+  quint32 nTerms;
+  uchar const *termTable;
+  uchar const *termPool;
+  uchar const *postPool;
+  quint32 nPages;
+  uchar const *pageTable;
+  uchar const *pagePool;
+  QMap<QString, Postings> overlay;
+  /* Maps words to their postings. Empty postings mark deleted words. */
+  QHash<int, QSet<QString> > overlayTerms;
+  /* Reverse of the overlay: maps start pages to the words in it whose
+     postings contain them. */
+  QHash<int, int> overlayLengths;
+  /* Document lengths that differ from the base; -1 marks dropped pages. */
+  int nDocs;
+  qint64 totalLength; // of all documents, for BM25's average
   QMap<int, QDateTime> lastseen;
+  class Trigrams *trigrams;
+  /* Null until built, on the first fuzzy lookup or by prepareFuzzy(),
+     and then kept up to date as words are added. */
+  class TrigramBuilder *trigramBuilder; // while being built
+  QStringList trigramBacklog; // words added while being built
+  int trigramGen; // tells results from an earlier builder apart
+  QThreadPool trigramPool;
 };
 
 #endif
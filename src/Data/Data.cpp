@@ -25,9 +25,12 @@
 #include "Notebook.h"
 #include "ElnAssert.h"
 #include "UUID.h"
+#include "JSONByteParser.h"
+#include "JSONWriter.h"
 
 Data::Data(Data *parent0): QObject(parent0) {
   loading_ = false;
+  saveCacheDepth_ = -1;
   setCreated(QDateTime::currentDateTime());
   setModified(QDateTime::currentDateTime());
   setUuid(UUID::create(32));
@@ -109,6 +112,7 @@ void Data::setType(QString const &t) {
 }
 
 void Data::markModified(Data::ModType mt) {
+  dropSaveCache();
   if (loading_)
     return;
 
@@ -134,6 +138,58 @@ void Data::load(QVariantMap const &src) {
   loading_ = false;
 }
 
+void Data::load(JSONByteParser &src, QString typ, bool more) {
+  /* This does the same as load(QVariantMap), except that properties are
+     set as soon as they are read and children are created straight from
+     the parser. Only fields that are neither properties nor "res" or "cc"
+     are collected into a (typically tiny) map for loadMore(). */
+  loading_ = true;
+  deleteAllChildren();
+  resTags.clear();
+  setType(typ);
+
+  QMetaObject const *metaobj = metaObject();
+  QVariantMap rest;
+  QVariant cre, mod;
+  while (more) {
+    QString key = src.readKey();
+    if (key=="cc") {
+      if (src.enterArray()) {
+        do {
+          create(src, this);
+        } while (src.nextElement());
+      }
+    } else if (key=="res") {
+      foreach (QVariant v, src.readAny().toList())
+        resTags.append(v.toString());
+    } else {
+      QVariant v = src.readAny();
+      QByteArray name = key.toLatin1();
+      int idx = metaobj->indexOfProperty(name.constData());
+      QMetaProperty metaprop = metaobj->property(idx);
+      if (idx>=0 && metaprop.isWritable()) {
+        if (metaprop.isEnumType())
+          // See loadProps() for why enums need this
+          MILDASSERT(setProperty(name.constData(), v.toInt()));
+        else
+          MILDASSERT(setProperty(name.constData(), v));
+      } else {
+        rest.insert(key, v);
+      }
+      if (key=="cre")
+        cre = v;
+      else if (key=="mod")
+        mod = v;
+    }
+    more = src.nextMember();
+  }
+
+  loadMore(rest);
+  setCreated(cre.toDateTime());
+  setModified(mod.toDateTime());
+  loading_ = false;
+}
+
 QVariantMap Data::save() const {
   QVariantMap dst;
   saveProps(dst);
@@ -143,6 +199,147 @@ QVariantMap Data::save() const {
   return dst;
 }
 
+void Data::save(JSONWriter &dst) const {
+  if (dst.isCompact() || dst.depth()==0) {
+    /* Top-level objects change whenever anything below them does, so
+       there is no point in keeping their encoded form. */
+    writeJSON(dst);
+    return;
+  }
+  fillSaveCache(dst.depth());
+  dst.writeRaw(saveCache_);
+}
+
+void Data::fillSaveCache(int depth) const {
+  if (saveCacheDepth_ == depth)
+    return;
+  saveCache_.resize(0);
+  JSONWriter w(saveCache_, false, depth);
+  writeJSON(w);
+  saveCacheDepth_ = depth;
+}
+
+void Data::dropSaveCache() {
+  for (Data *d = this; d; d = d->parent()) {
+    d->saveCache_.clear();
+    d->saveCacheDepth_ = -1;
+  }
+}
+
+void Data::saveOwn(QVariantMap &dst) const {
+  saveProps(dst);
+  saveResTags(dst);
+  saveMore(dst);
+  dst.remove("cc");
+}
+
+void Data::writeJSON(JSONWriter &dst) const {
+  QVariantMap own;
+  saveOwn(own);
+
+  dst.beginObject();
+  foreach (QString const &k, JSONWriter::orderedKeys(own)) {
+    dst.writeKey(k);
+    dst.writeValue(own[k]);
+  }
+  if (!children_.isEmpty()) {
+    dst.writeKey("cc");
+    dst.beginArray();
+    foreach (Data *d, children_)
+      d->save(dst);
+    dst.endArray();
+  }
+  dst.endObject();
+}
+
+bool Data::collectUuids(QHash<QString, Data *> &dst) {
+  bool unique = !dst.contains(uuid_);
+  dst[uuid_] = this;
+  foreach (Data *d, children_)
+    unique = d->collectUuids(dst) && unique;
+  return unique;
+}
+
+void Data::writeChanges(JSONWriter &dst, QSet<QString> const &known) const {
+  writeChanges(dst, known, 0);
+}
+
+void Data::writeChanges(JSONWriter &dst, QSet<QString> const &known,
+                        int depth) const {
+  /* An object whose encoded form is still valid has not changed, and
+     neither have any of its descendents, since dropSaveCache() always
+     works its way up to the root. */
+  if (depth>0 && saveCacheDepth_>=0)
+    return;
+
+  QVariantMap own;
+  saveOwn(own);
+  dst.beginObject();
+  dst.writeKey("uuid");
+  dst.writeValue(uuid_);
+  dst.writeKey("p");
+  dst.writeValue(own);
+  dst.writeKey("cc");
+  dst.beginArray();
+  foreach (Data *d, children_) {
+    if (known.contains(d->uuid_))
+      dst.writeValue(d->uuid_);
+    else
+      d->save(dst); // compact, so written in full
+  }
+  dst.endArray();
+  dst.endObject();
+
+  foreach (Data *d, children_)
+    if (known.contains(d->uuid_))
+      d->writeChanges(dst, known, depth + 2);
+
+  foreach (Data *d, children_)
+    d->fillSaveCache(depth + 2);
+  if (depth>0)
+    fillSaveCache(depth);
+}
+
+void Data::applyChange(QVariantMap const &rec, QHash<QString, Data *> &objs) {
+  loading_ = true;
+  foreach (Data *d, children_)
+    d->setParent(0);
+  children_.clear();
+  foreach (QVariant const &v, rec["cc"].toList()) {
+    if (v.type()==QVariant::Map) {
+      QVariantMap m = v.toMap();
+      Data *d = create(m["typ"].toString(), this);
+      if (d) {
+        d->load(m);
+        d->collectUuids(objs);
+      } else {
+        qDebug() << "Data: Failed to create child of type"
+                 << m["typ"].toString() << "(no creator)";
+      }
+    } else {
+      Data *d = objs.value(v.toString(), 0);
+      if (!d) {
+        qDebug() << "Data: Journal refers to unknown object" << v.toString();
+        continue;
+      }
+      Data *p = d->parent();
+      if (p)
+        p->children_.removeOne(d);
+      children_.append(d);
+      d->setParent(this);
+    }
+  }
+
+  QVariantMap own = rec["p"].toMap();
+  loadProps(own);
+  loadResTags(own);
+  loadMore(own);
+  setCreated(own["cre"].toDateTime());
+  setModified(own["mod"].toDateTime());
+  loading_ = false;
+  dropSaveCache();
+}
+
 void Data::loadResTags(QVariantMap const &src) {
   resTags.clear();
 
@@ -154,12 +351,16 @@ void Data::loadResTags(QVariantMap const &src) {
     resTags.append(v.toString());
 }
 
-void Data::loadChildren(QVariantMap const &src) {
+void Data::deleteAllChildren() {
   foreach (Data *d, children_) {
     d->setParent(0); // prevent warning
     delete d;
   }
   children_.clear();
+}
+
+void Data::loadChildren(QVariantMap const &src) {
+  deleteAllChildren();
 
   if (!src.contains("cc"))
     return;
@@ -335,6 +536,56 @@ Data *Data::create(QString t, Data *parent) {
     return 0;
 }
 
+Data *Data::create(JSONByteParser &src, Data *parent) {
+  if (!src.enterObject()) {
+    qDebug() << "Data: Failed to create object without type";
+    return 0;
+  }
+  QString key = src.readKey();
+  if (key!="typ") {
+    // Not written by us, so "typ" may be anywhere. Do it the slow way.
+    QVariantMap v;
+    v.insert(key, src.readAny());
+    while (src.nextMember()) {
+      key = src.readKey();
+      v.insert(key, src.readAny());
+    }
+    Data *d = create(v["typ"].toString(), parent);
+    if (d)
+      d->load(v);
+    else
+      qDebug() << "Data: Failed to create object of type"
+               << v["typ"].toString() << "(no creator)";
+    return d;
+  }
+
+  QString t = src.readAny().toString();
+  bool more = src.nextMember();
+  Data *d = create(t, parent);
+  if (!d) {
+    qDebug() << "Data: Failed to create object of type" << t
+             << "(no creator)";
+    while (more) {
+      src.readKey();
+      src.readAny();
+      more = src.nextMember();
+    }
+    return 0;
+  }
+
+  try {
+    d->load(src, t, more);
+  } catch (...) {
+    if (parent)
+      parent->children_.removeOne(d);
+    d->setParent(0);
+    d->deleteAllChildren();
+    delete d;
+    throw;
+  }
+  return d;
+}
+
 EntryData const *Data::entry() const {
   Data const *p = parent();
   return p ? p->entry() : 0;
@@ -421,3 +672,8 @@ QSet<QString> Data::wordSet() const {
     ws |= d->wordSet();
   return ws;
 }
+
+void Data::countWords(QHash<QString, int> &dst) const {
+  for (Data *d: allChildren())
+    d->countWords(dst);
+}
@@ -27,6 +27,7 @@
 #include <QVariant>
 #include <QMap>
 #include <QSet>
+#include <QHash>
 
 class Data: public QObject {
   Q_OBJECT;
@@ -47,6 +48,12 @@ public:
   Data(Data *parent=0);
   virtual ~Data();
   static Data *create(QString type, Data *parent=0);
+  static Data *create(class JSONByteParser &src, Data *parent=0);
+  /* Creates a Data of the type named by the "typ" field of the next
+     object in SRC and loads it in one pass, without building a
+     QVariantMap of the whole tree first. The object is consumed even if
+     there is no creator for its type, in which case we return null.
+     Parse errors are thrown as JSONByteParser::Error. */
   // read properties
   QDateTime const &created() const;
   QDateTime const &modified() const;
@@ -61,6 +68,11 @@ public:
   virtual void markModified(ModType mt=UserVisibleMod);
   void load(QVariantMap const &);
   QVariantMap save() const;
+  void save(class JSONWriter &dst) const;
+  /* Writes the same thing as save() would return, but without building
+     a QVariantMap of our descendents. Below top level, the encoded form
+     is kept until the next markModified(), so that saving an entry only
+     re-encodes the parts that actually changed. */
   virtual bool isWritable() const;
   virtual bool lateNotesAllowed() const;
   virtual bool isRecent() const;
@@ -85,17 +97,44 @@ public:
   QStringList const &resourceTags() const;
   void setResourceTags(QStringList const &);
   virtual QSet<QString> wordSet() const;
+  virtual void countWords(QHash<QString, int> &dst) const;
+  /* Adds the number of occurrences of each word in our subtree to DST.
+     Words are lowercased, as for wordSet(). */
+public: // journal support for DataFile0
+  bool collectUuids(QHash<QString, Data *> &dst);
+  /* Adds us and our descendents to DST, keyed by uuid. Returns false if
+     any uuid occurs more than once. */
+  void writeChanges(class JSONWriter &dst, QSet<QString> const &known) const;
+  /* Writes a journal record for each object in our subtree that has
+     changed since it was last saved. Children whose uuids are in KNOWN
+     are referred to by uuid; others are written in full. Afterwards,
+     the encoded forms kept by save(JSONWriter &) are up to date. */
+  void applyChange(QVariantMap const &rec, QHash<QString, Data *> &objs);
+  /* Applies a record written by writeChanges(). New objects are added
+     to OBJS. Former children that no record claims are left without a
+     parent; it is up to the caller to delete them. */
 signals:
   void mod();
 protected:
   virtual void loadMore(QVariantMap const &);
   virtual void saveMore(QVariantMap &) const;
   bool loading() const;
+  void dropSaveCache();
+  /* Forgets the encoded form kept by save(JSONWriter &) for us and our
+     ancestors. markModified() does this automatically; call it directly
+     if you change what saveMore() would write without marking. */
 private:
+  void load(class JSONByteParser &src, QString typ, bool more);
   void loadProps(QVariantMap const &);
   void saveProps(QVariantMap &) const;
   void loadChildren(QVariantMap const &);
+  void deleteAllChildren();
   void saveChildren(QVariantMap &) const;
+  void writeJSON(class JSONWriter &dst) const;
+  void fillSaveCache(int depth) const;
+  void writeChanges(class JSONWriter &dst, QSet<QString> const &known,
+                    int depth) const;
+  void saveOwn(QVariantMap &dst) const;
   void loadResTags(QVariantMap const &);
   void saveResTags(QVariantMap &) const;
 private:
@@ -107,6 +146,8 @@ private:
   QStringList resTags;
 private:
   bool loading_;
+  mutable QByteArray saveCache_;
+  mutable int saveCacheDepth_; // -1 if saveCache_ is not valid
 public:
   template <class T> static T *deepCopy(T const *data);
   /* T must be derived from Data. The copy will be parentless. */
@@ -18,6 +18,7 @@ HEADERS += \
      Data/MarkupData.h  \
      Data/MarkupEdges.h  \
      Data/MarkupStyles.h  \
+     Data/PhraseMatcher.h  \
      Data/Random.h  \
      Data/ResManager.h  \
      Data/Resource.h  \
@@ -27,6 +28,7 @@ HEADERS += \
      Data/TextBlockData.h  \
      Data/TextData.h  \
      Data/TitleData.h  \
+     Data/Tokenizer.h  \
      Data/UUID.h  \
 
 SOURCES += \
@@ -45,6 +47,7 @@ SOURCES += \
      Data/LateNoteData.cpp  \
      Data/MarkupData.cpp  \
      Data/MarkupEdges.cpp  \
+     Data/PhraseMatcher.cpp  \
      Data/Random.cpp  \
      Data/ResManager.cpp  \
      Data/Resource.cpp  \
@@ -55,6 +58,7 @@ SOURCES += \
      Data/TextBlockData.cpp  \
      Data/TextData.cpp  \
      Data/TitleData.cpp  \
+     Data/Tokenizer.cpp  \
      Data/UUID.cpp  \
 
 RESOURCES += \
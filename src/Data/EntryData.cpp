@@ -62,8 +62,9 @@ bool EntryData::isEmpty() const {
 
 void EntryData::insertBlockBefore(BlockData *b, Data *ref) {
   insertChildBefore(b, ref);
-  connect(b, SIGNAL(newSheet(int)), SLOT(newSheet()));
-  connect(b, SIGNAL(sheetCountMod(int)), SLOT(newSheet()));
+  connect(b, SIGNAL(newSheet(int)), SLOT(newSheet()), Qt::UniqueConnection);
+  connect(b, SIGNAL(sheetCountMod(int)), SLOT(newSheet()),
+            Qt::UniqueConnection);
   if (b->lastSheet()>maxSheet) {
     maxSheet = b->lastSheet();
     emit sheetCountMod();
@@ -109,7 +110,8 @@ void EntryData::loadMore(QVariantMap const &src) {
   TitleData *title_ = firstChild<TitleData>();
   // Any old title has already been destructed by Data's loadChildren()
   ASSERT(title_);
-  connect(title_, SIGNAL(textMod()), SIGNAL(titleMod()));
+  connect(title_, SIGNAL(textMod()), SIGNAL(titleMod()),
+          Qt::UniqueConnection);
 
   maxSheet = 0;
   foreach (BlockData *b, blocks()) {
@@ -0,0 +1,110 @@
+// Data/PhraseMatcher.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PhraseMatcher.cpp
+
+#include "PhraseMatcher.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define PHRASEMATCHER_SSE2 1
+#endif
+
+PhraseMatcher::PhraseMatcher(QString phrase): phr(phrase), pat(phrase) {
+  QChar *d = pat.data();
+  int n = pat.size();
+  for (int i=0; i<n; i++)
+    d[i] = fold(d[i]);
+  first0 = first1 = 0;
+  simd = false;
+  wide = false;
+  if (n>0 && pat[0].unicode()<0x80) {
+    first0 = pat[0].unicode();
+    first1 = (first0>='a' && first0<='z') ? first0 - 0x20 : first0;
+    simd = true;
+    // KELVIN SIGN and LATIN SMALL LETTER LONG S fold into ASCII
+    wide = first0=='k' || first0=='s';
+  }
+}
+
+bool PhraseMatcher::verify(QChar const *t) const {
+  QChar const *p = pat.constData();
+  int n = pat.size();
+  for (int j=0; j<n; j++)
+    if (fold(t[j])!=p[j])
+      return false;
+  return true;
+}
+
+int PhraseMatcher::scan(QChar const *t, int from, int last) const {
+  /* Returns the first position in [FROM, LAST] where the first
+     character might match, or -1. */
+  int i = from;
+#ifdef PHRASEMATCHER_SSE2
+  if (simd) {
+    __m128i a = _mm_set1_epi16(short(first0));
+    __m128i b = _mm_set1_epi16(short(first1));
+    __m128i hi = _mm_set1_epi16(short(0xff80));
+    __m128i zero = _mm_setzero_si128();
+    for (; i+8<=last+1; i+=8) {
+      __m128i x = _mm_loadu_si128((__m128i const *)(t + i));
+      __m128i m = _mm_or_si128(_mm_cmpeq_epi16(x, a), _mm_cmpeq_epi16(x, b));
+      if (wide) // anything non-ASCII is a candidate
+        m = _mm_or_si128(m, _mm_xor_si128(_mm_cmpeq_epi16(_mm_and_si128(x, hi),
+                                                           zero),
+                                          _mm_set1_epi16(-1)));
+      int bits = _mm_movemask_epi8(m);
+      if (bits) {
+        for (int j=0; j<8; j++)
+          if (bits & (1<<(2*j)))
+            return i + j;
+      }
+    }
+  }
+#endif
+  QChar f = pat[0];
+  for (; i<=last; i++)
+    if (fold(t[i])==f)
+      return i;
+  return -1;
+}
+
+int PhraseMatcher::indexIn(QChar const *t, int len, int from) const {
+  int n = pat.size();
+  if (from<0)
+    from = 0;
+  int last = len - n;
+  if (n==0)
+    return from<=len ? from : -1;
+  while (from<=last) {
+    int i = scan(t, from, last);
+    if (i<0)
+      return -1;
+    if (verify(t + i))
+      return i;
+    from = i + 1;
+  }
+  return -1;
+}
+
+int PhraseMatcher::indexIn(QString const &text, int from) const {
+  return indexIn(text.constData(), text.size(), from);
+}
+
+bool PhraseMatcher::matchesAt(QString const &text, int pos) const {
+  return pos>=0 && pos + pat.size()<=text.size()
+    && verify(text.constData() + pos);
+}
@@ -0,0 +1,64 @@
+// Data/PhraseMatcher.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PhraseMatcher.H
+
+#ifndef PHRASEMATCHER_H
+
+#define PHRASEMATCHER_H
+
+#include <QString>
+
+class PhraseMatcher {
+  /* A PhraseMatcher finds a phrase in text, case-insensitively, like
+     QString::indexOf with Qt::CaseInsensitive, but without allocating
+     anything per call. The phrase is case folded once, when the matcher
+     is made. Candidate positions for the first character are found
+     eight at a time where SSE2 is available, and verified by comparing
+     folded characters in place.
+     Typical use, to find all nonoverlapping occurrences:
+       PhraseMatcher m(phrase);
+       for (int i=m.indexIn(text); i>=0; i=m.indexIn(text, i+m.size()))
+         ...
+  */
+public:
+  PhraseMatcher(QString phrase=QString());
+  QString const &phrase() const { return phr; } // as given
+  int size() const { return pat.size(); }
+  bool isEmpty() const { return pat.isEmpty(); }
+  int indexIn(QString const &text, int from=0) const;
+  int indexIn(QChar const *text, int len, int from=0) const;
+  /* Returns the position of the first occurrence at or after FROM,
+     or -1. */
+  bool matchesAt(QString const &text, int pos) const;
+  static inline QChar fold(QChar c) {
+    ushort u = c.unicode();
+    if (u<0x80)
+      return (u>='A' && u<='Z') ? QChar(ushort(u | 0x20)) : c;
+    return c.toCaseFolded();
+  }
+private:
+  int scan(QChar const *text, int from, int last) const;
+  bool verify(QChar const *text) const;
+private:
+  QString phr;
+  QString pat; // folded
+  ushort first0, first1; // the two ASCII cases of the first character
+  bool simd; // first0 and first1 are valid for a vectorized scan
+  bool wide; // non-ASCII characters may also fold to the first character
+};
+
+#endif
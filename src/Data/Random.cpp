@@ -20,6 +20,8 @@
 #include <QDateTime>
 #include <QHash>
 #include <QNetworkInterface>
+#include <QThread>
+#include <QThreadStorage>
 
 quint16 Random::random() {
   if (!inited())
@@ -29,12 +31,17 @@ quint16 Random::random() {
 }
 
 bool &Random::inited() {
-  static bool x = false;
-  return x;
+  /* qrand() keeps its state per thread, so each thread needs to be seeded
+     separately. Entries are parsed on a FileReader thread, for instance. */
+  static QThreadStorage<bool *> x;
+  if (!x.hasLocalData())
+    x.setLocalData(new bool(false));
+  return *x.localData();
 }
 
 void Random::srandom() {
   qint64 t = QDateTime::currentDateTime().toMSecsSinceEpoch();
+  t ^= qHash(quintptr(QThread::currentThreadId()));
   qsrand(t);
   foreach (QHostAddress a, QNetworkInterface::allAddresses())
     t ^= qHash(a);
@@ -17,6 +17,7 @@
 // TextData.C
 
 #include "TextData.h"
+#include "Tokenizer.h"
 #include <QDebug>
 
 static Data::Creator<TextData> c("text");
@@ -45,9 +46,11 @@ void TextData::setText(QString const &t, bool hushhush) {
   if (text_==t)
     return;
   text_ = t;
-  wordset_.clear();
+  wordcounts_.clear();
   if (!hushhush)
     markModified();
+  else
+    dropSaveCache();
 }
 
 MarkupData *TextData::addMarkup(int start, int end,
@@ -167,11 +170,26 @@ QList<int> TextData::paragraphStarts() const {
   return res;
 }
 
-QSet<QString> TextData::wordSet() const {
-  if (wordset_.isEmpty() && !text_.isEmpty()) {
-    for (QString w: text_.split(QRegExp("\\W+")))
-      if (!w.isEmpty())
-        wordset_ << w.toLower();
+QHash<QString, int> const &TextData::ownWordCounts() const {
+  if (wordcounts_.isEmpty() && !text_.isEmpty()) {
+    Tokenizer tok(text_);
+    while (tok.next())
+      wordcounts_[tok.word()]++;
   }
-  return wordset_ | Data::wordSet();
+  return wordcounts_;
+}
+
+QSet<QString> TextData::wordSet() const {
+  QSet<QString> ws = Data::wordSet();
+  QHash<QString, int> const &wc = ownWordCounts();
+  for (auto it=wc.begin(); it!=wc.end(); ++it)
+    ws.insert(it.key());
+  return ws;
+}
+
+void TextData::countWords(QHash<QString, int> &dst) const {
+  QHash<QString, int> const &wc = ownWordCounts();
+  for (auto it=wc.begin(); it!=wc.end(); ++it)
+    dst[it.key()] += it.value();
+  Data::countWords(dst);
 }
@@ -66,13 +66,16 @@ public:
   /* Returns a markup that either starts or ends after START and before END. */
   int offsetOfFootnoteTag(QString) const;
   virtual QSet<QString> wordSet() const override;
+  virtual void countWords(QHash<QString, int> &dst) const override;
 protected:
+  QHash<QString, int> const &ownWordCounts() const;
+  /* Words in our text, not including children. */
   virtual void loadMore(QVariantMap const &);
   virtual void saveMore(QVariantMap &) const;
 protected:
   QString text_;
   QVector<int> linestarts;
-  mutable QSet<QString> wordset_;
+  mutable QHash<QString, int> wordcounts_; // cache for ownWordCounts()
 };
 
 #endif
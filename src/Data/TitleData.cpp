@@ -34,7 +34,8 @@ TitleData::~TitleData() {
 
 void TitleData::loadMore(QVariantMap const &vm) {
   Data::loadMore(vm);
-  connect(text(), SIGNAL(mod()), this, SIGNAL(textMod()));
+  connect(text(), SIGNAL(mod()), this, SIGNAL(textMod()),
+          Qt::UniqueConnection);
 }
   
 bool TitleData::isDefault() const {
@@ -0,0 +1,52 @@
+// Data/Tokenizer.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tokenizer.cpp
+
+#include "Tokenizer.h"
+
+Tokenizer::Tokenizer(QString const &text):
+  p(text.constData()), n(text.size()), k0(0), k1(0) {
+}
+
+bool Tokenizer::next() {
+  int k = k1;
+  while (k<n && !isWordChar(p[k]))
+    k++;
+  if (k>=n) {
+    k0 = k1 = n;
+    return false;
+  }
+  k0 = k;
+  while (k<n && isWordChar(p[k]))
+    k++;
+  k1 = k;
+  int len = k1 - k0;
+  buf.resize(len); // keeps the allocation unless a copy was kept
+  QChar *d = buf.data();
+  for (int i=0; i<len; i++)
+    d[i] = fold(p[k0+i]);
+  return true;
+}
+
+QString Tokenizer::fold(QString const &s) {
+  QString res(s);
+  QChar *d = res.data();
+  int n = res.size();
+  for (int i=0; i<n; i++)
+    d[i] = fold(d[i]);
+  return res;
+}
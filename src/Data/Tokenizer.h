@@ -0,0 +1,66 @@
+// Data/Tokenizer.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tokenizer.H
+
+#ifndef TOKENIZER_H
+
+#define TOKENIZER_H
+
+#include <QString>
+
+class Tokenizer {
+  /* A Tokenizer splits text into words: maximal runs of letters, digits,
+     marks, and underscores, just as QRegExp's \W+ would split it, and
+     lowercases them. ASCII characters are classified and lowercased
+     without consulting Unicode tables. Typical use:
+       Tokenizer tok(text);
+       while (tok.next())
+         counts[tok.word()]++;
+     The string returned by word() is reused for the next word, so no
+     memory is allocated for a word unless a copy is kept. The text must
+     outlive the Tokenizer.
+  */
+public:
+  Tokenizer(QString const &text);
+  bool next(); // false at end of text
+  int start() const { return k0; } // offset of current word in text
+  int length() const { return k1 - k0; }
+  QString const &word() const { return buf; } // lowercase
+public:
+  static inline bool isWordChar(QChar c) {
+    ushort u = c.unicode();
+    if (u<0x80)
+      return (u>='a' && u<='z') || (u>='A' && u<='Z')
+        || (u>='0' && u<='9') || u=='_';
+    return c.isLetterOrNumber() || c.isMark();
+  }
+  static inline QChar fold(QChar c) {
+    ushort u = c.unicode();
+    if (u<0x80)
+      return (u>='A' && u<='Z') ? QChar(ushort(u | 0x20)) : c;
+    return c.toLower();
+  }
+  static QString fold(QString const &);
+  /* Lowercases the way we do for words, for use on search phrases. */
+private:
+  QChar const *p;
+  int n;
+  int k0, k1;
+  QString buf;
+};
+
+#endif
@@ -4,6 +4,7 @@ HEADERS += \
      Dialogs/AboutBox.h  \
      Dialogs/CloneBookDialog.h  \
      Dialogs/GotoPageDialog.h  \
+     Dialogs/LiveSearch.h  \
      Dialogs/NewBookDialog.h  \
      Dialogs/PrintDialog.h  \
      Dialogs/SearchDialog.h  \
@@ -13,6 +14,7 @@ SOURCES += \
      Dialogs/AboutBox.cpp  \
      Dialogs/CloneBookDialog.cpp  \
      Dialogs/GotoPageDialog.cpp  \
+     Dialogs/LiveSearch.cpp  \
      Dialogs/NewBookDialog.cpp  \
      Dialogs/PrintDialog.cpp  \
      Dialogs/SearchDialog.cpp  \
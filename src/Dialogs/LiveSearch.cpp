@@ -0,0 +1,88 @@
+// Dialogs/LiveSearch.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// LiveSearch.cpp
+
+#include "LiveSearch.h"
+#include "SearchDialog.h"
+#include "SearchView.h"
+#include "SearchResultScene.h"
+#include "Search.h"
+#include "Notebook.h"
+#include "BookData.h"
+
+#define TYPING_DELAY_MS 250
+
+LiveSearch::LiveSearch(Notebook *book, QString phrase, QObject *parent):
+  QObject(parent), phrase(phrase) {
+  search = new Search(book, this);
+  SearchDialog::configure(search);
+  connect(search, SIGNAL(resultsFound()), SLOT(showResults()));
+  connect(search, SIGNAL(searchCompleted()), SLOT(showResults()));
+
+  scene = new SearchResultScene(phrase, "Search in notebook",
+                                QList<SearchResult>(), book->bookData());
+  scene->populate();
+  connect(scene, SIGNAL(destroyed()), SLOT(deleteLater()));
+  connect(scene,
+	  SIGNAL(pageNumberClicked(int, Qt::KeyboardModifiers,
+				   QString, QString)),
+	  SIGNAL(pageNumberClicked(int, Qt::KeyboardModifiers,
+				   QString, QString)));
+
+  view_ = new SearchView(scene);
+  view_->enableLiveEditing(phrase);
+  connect(view_, SIGNAL(phraseEdited(QString)), SLOT(edit(QString)));
+
+  delay = new QTimer(this);
+  delay->setSingleShot(true);
+  delay->setInterval(TYPING_DELAY_MS);
+  connect(delay, SIGNAL(timeout()), SLOT(start()));
+  if (!phrase.trimmed().isEmpty())
+    delay->start();
+}
+
+LiveSearch::~LiveSearch() {
+}
+
+SearchView *LiveSearch::view() const {
+  return view_;
+}
+
+void LiveSearch::edit(QString s) {
+  phrase = s;
+  delay->start(); // restarts if already running
+}
+
+void LiveSearch::start() {
+  if (phrase.trimmed().isEmpty()) {
+    search->abandonSearch();
+    scene->setPhrase(phrase, "Search in notebook");
+    scene->update(QList<SearchResult>());
+    if (view_)
+      view_->refresh();
+    return;
+  }
+  search->startSearchForPhrase(phrase.trimmed());
+}
+
+void LiveSearch::showResults() {
+  scene->setPhrase(search->currentPhrase(),
+                   SearchDialog::resultsTitle(search));
+  scene->update(search->searchResults());
+  if (view_)
+    view_->refresh();
+}
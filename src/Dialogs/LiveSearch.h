@@ -0,0 +1,54 @@
+// Dialogs/LiveSearch.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// LiveSearch.H
+
+#ifndef LIVESEARCH_H
+
+#define LIVESEARCH_H
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+class LiveSearch: public QObject {
+  /* A LiveSearch runs a search in a SearchView with a line editor, and
+     searches again whenever the user pauses typing. Each new query
+     abandons the previous one, which Search does without waiting for
+     its workers, and results of abandoned queries are never shown.
+     The LiveSearch deletes itself when its view is closed.
+  */
+  Q_OBJECT;
+public:
+  LiveSearch(class Notebook *book, QString phrase, QObject *parent=0);
+  virtual ~LiveSearch();
+  class SearchView *view() const;
+signals:
+  void pageNumberClicked(int, Qt::KeyboardModifiers,
+                         QString, QString); // pgno, uuid, phrase
+private slots:
+  void edit(QString);
+  void start();
+  void showResults();
+private:
+  class Search *search;
+  class SearchResultScene *scene;
+  QPointer<class SearchView> view_;
+  QTimer *delay;
+  QString phrase;
+};
+
+#endif
@@ -26,12 +26,14 @@
 //#include "FindOverlay.h"
 #include "ElnAssert.h"
 #include "SheetScene.h"
+#include "LiveSearch.h"
 
 #include <QInputDialog>
-#include <QProgressDialog>
 #include <QMessageBox>
 #include <QDebug>
 
+#define RANKED_ENTRIES 100
+
 SearchDialog::SearchDialog(PageView *parent): QObject(parent) {
   pgView = parent;
   lastPhrase = "";
@@ -50,38 +52,55 @@ void SearchDialog::newSearch() {
   if (phrase.isEmpty())
     return;
 
-  QProgressDialog *progress = new QProgressDialog(pgView);
-  progress->setLabelText("Searching...");
-  progress->setCancelButton(0);
-  progress->setMinimumDuration(500);
-  progress->setValue(0);
-  Search *search = new Search(pgView->notebook());
-  QList<SearchResult> res = search->immediatelyFindPhrase(phrase);
-
-  if (res.isEmpty()) {
-    delete progress;
-    QMessageBox::information(pgView, "Search - eln",
-                             QString::fromUtf8("Search phrase “%1” not found")
-                             .arg(phrase));
+  /* Results are shown as soon as the first batch comes in, and the view
+     is updated as more arrive. Closing the view abandons the search. */
+  Search *search = new Search(pgView->notebook(), this);
+  configure(search);
+  connect(search, SIGNAL(resultsFound()), SLOT(showResults()));
+  connect(search, SIGNAL(searchCompleted()), SLOT(completeSearch()));
+  connect(search, SIGNAL(destroyed(QObject*)), SLOT(forgetSearch(QObject*)));
+  scenes[search] = 0;
+  search->startSearchForPhrase(phrase);
+}
+
+void SearchDialog::showResults() {
+  Search *search = dynamic_cast<Search *>(sender());
+  if (!search || !scenes.contains(search))
+    return;
+  SearchResultScene *scene = scenes[search];
+  if (scene) {
+    scene->update(search->searchResults());
     return;
   }
   
-  SearchResultScene *scene
-    = new SearchResultScene(phrase,
-			    QString::fromUtf8("Search results for “%1”")
-			    .arg(phrase),
-			    res,
-			    pgView->notebook()->bookData());
+  scene = new SearchResultScene(search->currentPhrase(),
+                                resultsTitle(search),
+                                search->searchResults(),
+                                pgView->notebook()->bookData());
   scene->populate();
+  scenes[search] = scene;
+  connect(scene, SIGNAL(destroyed()), search, SLOT(deleteLater()));
   connect(scene,
 	  SIGNAL(pageNumberClicked(int, Qt::KeyboardModifiers,
 				   QString, QString)),
 	  this,
 	  SLOT(gotoPage(int, Qt::KeyboardModifiers, QString, QString)));
-  SearchView *view = new SearchView(scene);
+  showView(new SearchView(scene));
+}
+
+void SearchDialog::newLiveSearch() {
+  LiveSearch *live = new LiveSearch(pgView->notebook(), lastPhrase, this);
+  connect(live,
+	  SIGNAL(pageNumberClicked(int, Qt::KeyboardModifiers,
+				   QString, QString)),
+	  this,
+	  SLOT(gotoPage(int, Qt::KeyboardModifiers, QString, QString)));
+  showView(live->view());
+}
+
+void SearchDialog::showView(SearchView *view) {
   view->setAttribute(Qt::WA_DeleteOnClose, true);
   connect(parent(), SIGNAL(destroyed()), view, SLOT(close()));
-  delete progress;
   
   view->resize(pgView->size()*.9);
   QString ttl = pgView->notebook()->bookData()->title();
@@ -90,6 +109,41 @@ void SearchDialog::newSearch() {
   view->show();
 }
 
+void SearchDialog::configure(Search *search) {
+  search->setRankLimit(RANKED_ENTRIES);
+  search->setFuzzy(true);
+}
+
+QString SearchDialog::resultsTitle(Search const *search) {
+  QString phrase = search->currentPhrase();
+  QString ttl = phrase.isEmpty() ? QString("Search results")
+    : QString::fromUtf8("Search results for “%1”").arg(phrase);
+  if (search->isRanked())
+    ttl = QString::fromUtf8("Most relevant %1 of %2 entries with “%3”")
+      .arg(RANKED_ENTRIES).arg(search->candidateCount()).arg(phrase);
+  if (search->typedPhrase()!=phrase)
+    ttl += QString::fromUtf8(" (nothing found for “%1”)")
+      .arg(search->typedPhrase());
+  return ttl;
+}
+
+void SearchDialog::completeSearch() {
+  Search *search = dynamic_cast<Search *>(sender());
+  if (!search || !scenes.contains(search) || scenes[search])
+    return;
+  QString phrase = search->typedPhrase();
+  search->deleteLater();
+  QMessageBox::information(pgView, "Search - eln",
+                           phrase.isEmpty()
+                           ? QString("Nothing matches the search filters")
+                           : QString::fromUtf8("Search phrase “%1” not found")
+                           .arg(phrase));
+}
+
+void SearchDialog::forgetSearch(QObject *search) {
+  scenes.remove(search);
+}
+
 void SearchDialog::gotoPage(int n, Qt::KeyboardModifiers m,
                             QString uuid, QString phrase) {
   setLatestPhrase(phrase);
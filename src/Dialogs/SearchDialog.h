@@ -22,6 +22,7 @@
 
 #include <QObject>
 #include <QPointer>
+#include <QMap>
 #include "PageView.h"
 
 class SearchDialog: public QObject {
@@ -31,13 +32,25 @@ public:
   virtual ~SearchDialog();
   static QString latestPhrase();
   static void setLatestPhrase(QString);
+  static void configure(class Search *);
+  /* Sets ranking and fuzziness the way we like them. */
+  static QString resultsTitle(class Search const *);
 public slots:
   void newSearch();
+  void newLiveSearch();
+  /* Opens a result view with a line editor, which searches as you type. */
 private slots:
   void gotoPage(int n, Qt::KeyboardModifiers, QString uuid, QString phrase);
+  void showResults();
+  void completeSearch();
+  void forgetSearch(QObject *);
 private:
+  void showView(class SearchView *);
   QPointer<PageView> pgView;
   QString lastPhrase;
+  QMap<QObject *, class SearchResultScene *> scenes;
+  /* Maps running or displayed searches to their scenes, which are null
+     until the first results come in. */
   static QString &storedPhrase();
 };
 
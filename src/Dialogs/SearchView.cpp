@@ -19,6 +19,7 @@
 #include "SearchView.h"
 #include "SearchResultScene.h"
 #include <QKeyEvent>
+#include <QLineEdit>
 #include <QWheelEvent>
 #include <QPrinter>
 #include <QPrintDialog>
@@ -33,15 +34,40 @@ SearchView::SearchView(SearchResultScene *scene, QWidget *parent):
   setDragMode(NoDrag);
   wheelDeltaAccum = 0;
   wheelDeltaStepSize = 120; // should get from notebook
+  editor = 0;
   gotoSheet(0);
 }
 
+void SearchView::enableLiveEditing(QString phrase) {
+  if (editor)
+    return;
+  editor = new QLineEdit(this);
+  editor->setPlaceholderText("Search phrase");
+  editor->setText(phrase);
+  editor->move(4, 4);
+  editor->resize(width()/3, editor->sizeHint().height());
+  editor->show();
+  editor->setFocus();
+  connect(editor, SIGNAL(textEdited(QString)),
+          this, SIGNAL(phraseEdited(QString)));
+}
+
+void SearchView::refresh() {
+  int n = currentSheet;
+  if (n>=srs->sheetCount())
+    n = srs->sheetCount() - 1;
+  currentSheet = -1; // force
+  gotoSheet(n<0 ? 0 : n);
+}
+
 SearchView::~SearchView() {
   srs->deleteLater();
 }
 
 void SearchView::resizeEvent(QResizeEvent *e) {
   QGraphicsView::resizeEvent(e);
+  if (editor)
+    editor->resize(width()/3, editor->height());
   QRectF sr = scene()->sceneRect();
   sr.adjust(1, 1, -2, -2); // make sure no borders show by default
   fitInView(sr, Qt::KeepAspectRatio);
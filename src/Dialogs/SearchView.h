@@ -23,10 +23,18 @@
 #include <QGraphicsView>
 
 class SearchView: public QGraphicsView {
+  Q_OBJECT;
 public:
   SearchView(class SearchResultScene *scene, QWidget *parent=0);
   /* We become the owner of the scene! */
   virtual ~SearchView();
+  void enableLiveEditing(QString phrase);
+  /* Shows a line editor for the search phrase, which emits
+     phraseEdited() as the user types. */
+  void refresh();
+  /* Call after the scene has been updated. */
+signals:
+  void phraseEdited(QString);
 protected:
   void resizeEvent(QResizeEvent *);
   void keyPressEvent(QKeyEvent *);
@@ -38,6 +46,7 @@ private:
   double wheelDeltaAccum;
   double wheelDeltaStepSize;
   int currentSheet;
+  class QLineEdit *editor;
 };
 
 #endif
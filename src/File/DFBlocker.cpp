@@ -21,10 +21,12 @@
 #include <QTimerEvent>
 
 DFBlocker::DFBlocker(QObject *parent): QObject(parent) {
+  DataFile0::addBlocker(this);
   startTimer(DataFile0::maxBlockDuration()*1000);
 }
 
 DFBlocker::~DFBlocker() {
+  DataFile0::removeBlocker(this);
 }
 
 void DFBlocker::timerEvent(QTimerEvent *e) {
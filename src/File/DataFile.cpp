@@ -18,41 +18,71 @@
 
 #include "DataFile.h"
 #include <QDebug>
-#include <QTimer>
+#include <QFile>
 #include "JSONFile.h"
+#include "JSONByteParser.h"
+#include "JSONWriter.h"
 #include "ElnAssert.h"
 #include "DFBlocker.h"
 #include "PointerSet.h"
-
-double DataFile0::saveDelay_s = 5; // save every 5 s
+#include "FileWriter.h"
+#include "SaveScheduler.h"
 
 void DataFile0::setSaveDelay(double t_s) {
-  saveDelay_s = t_s;
+  SaveScheduler::instance()->setDelay(t_s);
+}
+
+Data *DataFile0::parse(QString fn) {
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly)) {
+    qDebug() << "DataFile: failed to load " << fn;
+    return 0;
+  }
+
+  /* We read straight into the Data tree, without an intermediate
+     QVariantMap. */
+  JSONByteParser parser(f.readAll());
+  f.close();
+  Data *data = 0;
+  try {
+    data = Data::create(parser);
+    parser.assertEnd();
+  } catch (JSONByteParser::Error const &e) {
+    e.report();
+    qDebug() << "DataFile: failed to load " << fn;
+    delete data;
+    return 0;
+  }
+  if (!data)
+    qDebug() << "DataFile: failed to load " << fn;
+  return data;
 }
 
-DataFile0::DataFile0(QString fn, QObject *parent):
+DataFile0::DataFile0(QString fn, QObject *parent, Data *parsed):
   QObject(parent),
   data_(0),
   fn_(fn),
   needToSave_(false),
-  saveTimer_(0) {
-  
-  QVariantMap v = JSONFile::load(fn, &ok_);
-
-  if (!ok_) {
-    qDebug() << "DataFile: failed to load " << fn;
-    return;
-  }
-  data_ = Data::create(v["typ"].toString());
+  savedLast_(false),
+  journaled_(false),
+  hasJournal_(false),
+  keepJournal_(false),
+  fullWrite_(0),
+  lastAppend_(0),
+  journalRemoval_(0) {
+  data_ = parsed ? parsed : parse(fn);
   ok_ = data_!=0;
-  if (!ok_) {
-    qDebug() << "DataFile: No creator for type "
-	     << v["typ"].toString();
+  if (!ok_)
     return;
+
+  if (QFile(journalFileName()).exists()) {
+    /* We only replay here. Whoever loaded us decides whether to compact,
+       which a read-only notebook must not do. */
+    replayJournal();
+    hasJournal_ = true;
   }
 
   data_->setParent(this); // just a QObject as a parent
-  data_->load(v);
   connect(data_, SIGNAL(mod()), this, SLOT(saveSoon()));
 }
 
@@ -61,13 +91,20 @@ DataFile0::DataFile0(Data *data, QString fn, QObject *parent):
   data_(data),
   fn_(fn),
   needToSave_(true),
-  saveTimer_(0) {
+  savedLast_(false),
+  journaled_(false),
+  hasJournal_(false),
+  keepJournal_(false),
+  fullWrite_(0),
+  lastAppend_(0),
+  journalRemoval_(0) {
   ok_ = data_ != 0;
   ASSERT(data_);
   if (!ok_)
     return;
   data_->setParent(this);
-  ok_ = saveNow(true);
+  saveNow(true);
+  finishWrites(); // so that ok() is meaningful
   connect(data_, SIGNAL(mod()), this, SLOT(saveSoon()));
 }
 
@@ -88,11 +125,167 @@ bool DataFile0::saveNow(bool force) {
     return false;
   }
 
-  ok_ = JSONFile::save(data_->save(), fn_);  
-  if (ok_) {
-    needToSave_ = false;
-    emit saved();
+  if (!journaled_ || persisted_.isEmpty() || !saveToJournal())
+    saveInFull();
+  needToSave_ = false;
+  return ok_;
+}
+
+void DataFile0::queueWrite(QByteArray const &data, FileWriter::Mode mode,
+                           bool announce) {
+  FileWriter *fw = FileWriter::instance();
+  connect(fw, SIGNAL(written(int, bool)), this, SLOT(writeDone(int, bool)),
+          Qt::UniqueConnection);
+  QString fn = mode==FileWriter::Replace ? fn_ : journalFileName();
+  int id = fw->write(fn, data, mode);
+  pendingWrites_[id] = announce;
+  if (mode==FileWriter::Replace)
+    fullWrite_ = id;
+  else
+    lastAppend_ = id;
+  if (isBlocked())
+    /* Version control must never see a half-written file. Normally, we
+       don't get here while blocked, but our destructor, for one, must
+       save regardless. */
+    fw->waitFor(id);
+}
+
+void DataFile0::writeDone(int id, bool ok) {
+  if (!pendingWrites_.contains(id))
+    return;
+  bool announce = pendingWrites_.take(id);
+  if (id==journalRemoval_) {
+    journalRemoval_ = 0;
+    if (!ok)
+      hasJournal_ = true; // try again after the next full save
+    return;
+  }
+  if (ok) {
+    ok_ = true;
+    if (id==fullWrite_) {
+      fullWrite_ = 0;
+      /* Only now is the journal redundant. If we appended to it since,
+         it must stay until the next full save. Replaying the older
+         records first does no harm, as later records override them. */
+      if (lastAppend_<id)
+        removeJournal();
+    }
+    if (announce)
+      emit saved();
+  } else {
+    ok_ = false;
+    needToSave_ = true;
+    persisted_.clear(); // next save must be complete
   }
+}
+
+void DataFile0::finishWrites() {
+  /* Completing a full save may queue the removal of the journal. */
+  while (!pendingWrites_.isEmpty())
+    FileWriter::instance()->waitFor(pendingWrites_.lastKey());
+}
+
+void DataFile0::finishAllWrites() {
+  FileWriter::instance()->waitForAll();
+}
+
+void DataFile0::saveInFull() {
+  if (saveBuffer_.capacity()==0)
+    saveBuffer_.reserve(64*1024);
+  saveBuffer_.resize(0); // keeps the capacity, if we still own it
+  JSONWriter writer(saveBuffer_);
+  data_->save(writer);
+  persisted_.clear();
+  queueWrite(saveBuffer_, FileWriter::Replace, true);
+  // The journal goes once writeDone() knows that this worked
+  if (journaled_) {
+    QHash<QString, Data *> objs;
+    if (data_->collectUuids(objs))
+      persisted_ = objs.keys().toSet();
+  }
+}
+
+bool DataFile0::saveToJournal() {
+  QHash<QString, Data *> objs;
+  if (!data_->collectUuids(objs))
+    return false;
+
+  saveBuffer_.resize(0);
+  JSONWriter writer(saveBuffer_, true);
+  data_->writeChanges(writer, persisted_);
+  saveBuffer_ += "\n";
+  queueWrite(saveBuffer_, FileWriter::Append, true);
+  hasJournal_ = true;
+  persisted_ = objs.keys().toSet();
+  return true;
+}
+
+void DataFile0::replayJournal() {
+  QFile f(journalFileName());
+  if (!f.open(QFile::ReadOnly))
+    return;
+  
+  QHash<QString, Data *> objs;
+  data_->collectUuids(objs);
+  JSONByteParser parser(f.readAll());
+  f.close();
+  try {
+    while (!parser.atEnd()) {
+      QVariantMap rec = parser.readObject();
+      Data *d = objs.value(rec["uuid"].toString(), 0);
+      if (d)
+        d->applyChange(rec, objs);
+      else
+        qDebug() << "DataFile: Journal refers to unknown object"
+                 << rec["uuid"].toString();
+    }
+  } catch (JSONByteParser::Error const &e) {
+    // A crash while appending can leave a partial record at the end
+    e.report();
+    qDebug() << "DataFile: ignoring rest of journal for " << fn_;
+  }
+
+  QList<Data *> orphans;
+  foreach (Data *d, objs) 
+    if (d!=data_ && !d->parent())
+      orphans << d;
+  foreach (Data *d, orphans)
+    delete d;
+}
+
+QString DataFile0::journalFileName() const {
+  return fn_ + ".journal";
+}
+
+void DataFile0::removeJournal() {
+  if (!hasJournal_)
+    return;
+  /* Not through queueWrite(), because we may be called from within
+     FileWriter::waitFor(). Version control ignores journals anyway. */
+  FileWriter *fw = FileWriter::instance();
+  journalRemoval_ = fw->write(journalFileName(), QByteArray(),
+                              FileWriter::Remove);
+  pendingWrites_[journalRemoval_] = false;
+  hasJournal_ = false;
+}
+
+bool DataFile0::hasJournal() const {
+  return hasJournal_;
+}
+
+void DataFile0::setJournaled(bool j) {
+  journaled_ = j;
+  if (!j)
+    persisted_.clear();
+}
+
+bool DataFile0::compactJournal() {
+  if (!hasJournal_ || keepJournal_)
+    return saveNow();
+  if (!data_)
+    return false;
+  saveInFull();
+  needToSave_ = false;
   return ok_;
 }
 
@@ -102,25 +295,16 @@ bool DataFile0::needToSave() const {
 
 void DataFile0::cancelSave() {
   needToSave_ = false;
+  keepJournal_ = true; // don't compact either; the journal is left as is
 }
   
 
 void DataFile0::saveSoon() {
-  if (!saveTimer_) {
-    saveTimer_ = new QTimer(this);
-    connect(saveTimer_, SIGNAL(timeout()),
-	    this, SLOT(saveTimerTimeout()));
-  }
-  
   needToSave_ = true;
-  if (!saveTimer_->isActive()) {
-    // saveTimer not active: activate it
-    saveTimer_->setSingleShot(true);
-    saveTimer_->start(int(saveDelay_s * 1e3));
-  }
+  SaveScheduler::instance()->schedule(this);
 }
 
-void DataFile0::saveTimerTimeout() {
+void DataFile0::scheduledSave() {
   if (needToSave_) {
     if (isBlocked())
       saveWhenUnblocked();
@@ -129,11 +313,22 @@ void DataFile0::saveTimerTimeout() {
   }
 }
 
+void DataFile0::setSavedLast(bool l) {
+  savedLast_ = l;
+}
+
+bool DataFile0::isSavedLast() const {
+  return savedLast_;
+}
+
 DataFile0::~DataFile0() {
   if (needToSave_) {
     qDebug() << "DataFile0: Caution: DataFile0 destructed while waiting to save";
     saveNow();
   }
+  if (hasJournal_ && !keepJournal_)
+    compactJournal();
+  finishWrites();
 }
 
 Data *DataFile0::data() const {
@@ -162,6 +357,7 @@ int &DataFile0::maxBlockDur() {
 
 void DataFile0::addBlocker(DFBlocker *b) {
   blockers().insert(b);
+  finishAllWrites();
 }
 
 void DataFile0::removeBlocker(DFBlocker *b) {
@@ -22,6 +22,7 @@
 
 #include "Data.h"
 #include <QPointer>
+#include "FileWriter.h"
 
 class DataFile0: public QObject {
   Q_OBJECT;
@@ -30,29 +31,70 @@ public:  virtual ~DataFile0();
   Data *data() const;
   bool saveNow(bool force=false);
   // Won't do anything if needToSave() is false, unless FORCE is set.
-  // Returns true if ok, even if nothing was saved.
+  // The actual writing happens on the FileWriter thread; we return
+  // ok() as of the last completed write.
   QString fileName() const;
   bool needToSave() const;
+  void setJournaled(bool);
+  /* A journaled file saves only what changed since the previous save,
+     by appending to FILENAME.journal. The journal is replayed when the
+     file is next loaded, and compacted by the next full save, by
+     compactJournal(), or on destruction. cancelSave() leaves it on disk
+     as it is. Only works if all uuids in the tree are unique;
+     otherwise, we quietly save the whole file as usual. */
+  bool hasJournal() const;
+  bool compactJournal();
+  /* Saves the whole file and removes the journal, if any. */
 public slots:
   void cancelSave();
   void saveSoon();
+  void setSavedLast(bool);
+  /* Files that summarize others, like the TOC, are saved after all the
+     others in a SaveScheduler cycle. */
+  bool isSavedLast() const;
+  void scheduledSave(); // for use by SaveScheduler
 public:
   static void setSaveDelay(double t_s);
+  static void finishAllWrites();
+  /* Blocks until all queued writes, for any file, have completed. */
 signals:
   void saved();
 protected:
 public:
   DataFile0(Data *data, QString fn, QObject *parent=0); // creates
-  DataFile0(QString fn, QObject *parent=0); // loads
+  DataFile0(QString fn, QObject *parent=0, Data *parsed=0); // loads
+  /* If PARSED is given, it must be what parse(FN) returned, and we take
+     ownership. */
+  static Data *parse(QString fn);
+  /* Reads and parses FN without constructing a DataFile. This is safe to
+     call from any thread; the tree belongs to the calling thread.
+     Returns 0 on failure. */
 private slots:
-  void saveTimerTimeout();
+  void writeDone(int id, bool ok);
+private:
+  void queueWrite(QByteArray const &data, FileWriter::Mode mode,
+                  bool announce);
+  void finishWrites();
+  QString journalFileName() const;
+  bool saveToJournal();
+  void saveInFull();
+  void replayJournal();
+  void removeJournal();
 private:
   bool ok_;
   QPointer<Data> data_;
   QString fn_;
   bool needToSave_;
-  class QTimer *saveTimer_;
-  static double saveDelay_s;
+  bool savedLast_;
+  QByteArray saveBuffer_; // reused, so we don't reallocate on every save
+  bool journaled_;
+  bool hasJournal_; // true while a journal is, or will be, on disk
+  bool keepJournal_; // set by cancelSave()
+  int fullWrite_; // ID of pending full save, or zero
+  int lastAppend_; // ID of last append to the journal
+  int journalRemoval_; // ID of pending removal, or zero
+  QSet<QString> persisted_; // uuids as of last save; empty if unknown
+  QMap<int, bool> pendingWrites_; // value is true if saved() is due
 public:
   static void addBlocker(class DFBlocker *);
   static void removeBlocker(class DFBlocker *);
@@ -71,8 +113,8 @@ template <class T> class DataFile: public DataFile0 {
  protected:
   DataFile<T>(T *data, QString fn, QObject *parent=0):
     DataFile0(data, fn, parent) { }
-  DataFile<T>(QString fn, QObject *parent=0):
-    DataFile0(fn, parent) { }
+  DataFile<T>(QString fn, QObject *parent=0, T *parsed=0):
+    DataFile0(fn, parent, parsed) { }
  public:
   T *data() const { return dynamic_cast<T*>(DataFile0::data()); }
   static DataFile<T> *create(QString fn, QObject *parent=0) {
@@ -90,8 +132,8 @@ template <class T> class DataFile: public DataFile0 {
     delete df;
     return 0;
   }
-  static DataFile<T> *load(QString fn, QObject *parent=0) {
-    DataFile<T> *df = new DataFile<T>(fn, parent);
+  static DataFile<T> *load(QString fn, QObject *parent=0, T *parsed=0) {
+    DataFile<T> *df = new DataFile<T>(fn, parent, parsed);
     if (df->ok())
       return df;
     delete df;
@@ -90,3 +90,11 @@ QSet<QString> Entry::wordSet() const {
     d |= lnm_->wordSet();
   return d;
 }
+
+QHash<QString, int> Entry::wordCounts() const {
+  QHash<QString, int> d;
+  data()->countWords(d);
+  if (lnm_)
+    lnm_->countWords(d);
+  return d;
+}
@@ -40,6 +40,7 @@ public:
   bool needToSave() const;
   void setBook(class Notebook *);
   QSet<QString> wordSet() const; // does *not* ensure that late notes are loaded
+  QHash<QString, int> wordCounts() const; // ditto
 private:
   EntryData *data_;
   EntryFile *file_;
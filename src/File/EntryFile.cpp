@@ -22,6 +22,15 @@
 #include "ElnAssert.h"
 #include "UUID.h"
 
+static bool &entryJournaling() {
+  static bool j = false;
+  return j;
+}
+
+void setEntryJournaling(bool j) {
+  entryJournaling() = j;
+}
+
 static QString basicFilename(int pgno, QString uuid) {
   return QString("%1-%2") . arg(pgno, 4, 10, QChar('0')) . arg(uuid);
 }
@@ -33,6 +42,7 @@ EntryFile *createEntry(QDir const &dir, int n, QObject *parent) {
   EntryFile *f = EntryFile::create(pfn, parent);
   if (!f)
     return 0;
+  f->setJournaled(entryJournaling());
   f->data()->setUuid(uuid);
   ResManager *r = new ResManager(f->data());
   QString resfn = dir.absoluteFilePath(fn0 + ".res");
@@ -65,6 +75,7 @@ bool deleteEntryFile(QDir dir, int n, QString uuid) {
   QString jsonfn = fn0 + ".json";
   QString resfn = fn0 + ".res";
   dir.remove(jsonfn + "~");
+  dir.remove(jsonfn + ".journal");
   removeDir(dir, resfn + "~");
   bool ok = dir.rename(jsonfn, jsonfn + "~");
   dir.rename(resfn, resfn + "~");
@@ -72,19 +83,26 @@ bool deleteEntryFile(QDir dir, int n, QString uuid) {
 }
 
 
-EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent) {
+QString entryFilename(QDir const &dir, int n, QString uuid) {
   QString fn0 = basicFilename(n, uuid);
   if (!dir.exists(fn0 + ".json"))
     fn0 = QString::number(n); // quietly revert to old style
-  QString pfn = dir.absoluteFilePath(fn0 + ".json");
-  EntryFile *f = EntryFile::load(pfn, parent);
+  return dir.absoluteFilePath(fn0 + ".json");
+}
+
+EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent,
+                     EntryData *parsed) {
+  QString pfn = entryFilename(dir, n, uuid);
+  EntryFile *f = EntryFile::load(pfn, parent, parsed);
   if (!f)
     return 0;
+  f->setJournaled(entryJournaling());
 
   ResManager *r = f->data()->resManager();
   if (!r)
     r = new ResManager(f->data());
-  QString resfn = dir.absoluteFilePath(fn0 + ".res");
+  QString resfn = pfn;
+  resfn.replace(resfn.length()-5, 5, ".res");
   r->setRoot(resfn);
   return f;
 }
@@ -28,9 +28,17 @@ typedef DataFile<EntryData> EntryFile;
 
 EntryFile *createEntry(QDir const &dir, int n, QObject *parent=0);
 /* createEntry returns NULL if the file cannot be created */
-EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent=0);
-/* loadEntry returns NULL if the file cannot be found */
+EntryFile *loadEntry(QDir const &dir, int n, QString uuid, QObject *parent=0,
+                     EntryData *parsed=0);
+/* loadEntry returns NULL if the file cannot be found. If PARSED is given,
+   it must be the result of DataFile0::parse() on entryFilename(). */
+QString entryFilename(QDir const &dir, int n, QString uuid);
+/* Full path of the json file for an entry, which need not exist. */
 
 bool deleteEntryFile(QDir dir, int n, QString uuid);
 
+void setEntryJournaling(bool);
+/* If set, entries created or loaded afterwards save only their changes
+   to a journal between compactions. See DataFile0::setJournaled. */
+
 #endif
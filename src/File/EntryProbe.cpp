@@ -0,0 +1,152 @@
+// File/EntryProbe.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// EntryProbe.cpp
+
+#include "EntryProbe.h"
+#include "JSONByteParser.h"
+#include <QFile>
+#include <QDebug>
+
+EntryProbe::EntryProbe(QString fn) {
+  ok_ = false;
+  maxSheet_ = 0;
+  QFile f(fn);
+  if (!f.open(QFile::ReadOnly)) {
+    qDebug() << "EntryProbe: failed to open" << fn;
+    return;
+  }
+  JSONByteParser parser(f.readAll());
+  f.close();
+  try {
+    if (parser.enterObject()) {
+      do {
+        QString key = parser.readKey();
+        char c = parser.peekNext();
+        if (key=="cc")
+          readChildren(parser);
+        else if (c=='{' || c=='[')
+          parser.skipAny();
+        else
+          fields_[key] = parser.readAny();
+      } while (parser.nextMember());
+    }
+  } catch (JSONByteParser::Error const &e) {
+    e.report();
+    qDebug() << "EntryProbe: failed to read" << fn;
+    return;
+  }
+  ok_ = type()=="page";
+}
+
+void EntryProbe::readChildren(JSONByteParser &parser) {
+  /* The children of an entry are its title and its blocks. */
+  if (parser.peekNext()!='[') {
+    parser.skipAny();
+    return;
+  }
+  if (!parser.enterArray())
+    return;
+  do {
+    if (parser.peekNext()!='{') {
+      parser.skipAny();
+      continue;
+    }
+    QString typ;
+    QString text;
+    int sheet = -1;
+    int nSplits = 0;
+    if (parser.enterObject()) {
+      do {
+        QString key = parser.readKey();
+        if (key=="typ") {
+          typ = parser.readAny().toString();
+        } else if (key=="sheet") {
+          sheet = parser.readAny().toInt();
+        } else if (key=="split" && parser.peekNext()=='[') {
+          if (parser.enterArray()) {
+            do {
+              parser.skipAny();
+              nSplits++;
+            } while (parser.nextElement());
+          }
+        } else if (key=="cc" && (typ.isEmpty() || typ=="title")) {
+          // "typ" normally comes first, but we do not rely on it
+          text = readTitle(parser);
+        } else {
+          parser.skipAny();
+        }
+      } while (parser.nextMember());
+    }
+    if (typ=="title" && title_.isNull())
+      title_ = text;
+    if (sheet>=0 && sheet + nSplits > maxSheet_)
+      maxSheet_ = sheet + nSplits; // as in BlockData::lastSheet()
+  } while (parser.nextElement());
+}
+
+QString EntryProbe::readTitle(JSONByteParser &parser) {
+  /* Returns the "text" of the first child. */
+  QString text;
+  if (parser.peekNext()!='[') {
+    parser.skipAny();
+    return text;
+  }
+  if (!parser.enterArray())
+    return text;
+  bool first = true;
+  do {
+    if (first && parser.peekNext()=='{') {
+      if (parser.enterObject()) {
+        do {
+          QString key = parser.readKey();
+          if (key=="text" && parser.peekNext()=='"')
+            text = parser.readAny().toString();
+          else
+            parser.skipAny();
+        } while (parser.nextMember());
+      }
+    } else {
+      parser.skipAny();
+    }
+    first = false;
+  } while (parser.nextElement());
+  return text;
+}
+
+QVariant EntryProbe::value(QString key) const {
+  return fields_.value(key);
+}
+
+QString EntryProbe::type() const {
+  return fields_.value("typ").toString();
+}
+
+QString EntryProbe::uuid() const {
+  return fields_.value("uuid").toString();
+}
+
+QDateTime EntryProbe::created() const {
+  return fields_.value("cre").toDateTime();
+}
+
+QDateTime EntryProbe::modified() const {
+  return fields_.value("mod").toDateTime();
+}
+
+int EntryProbe::startPage() const {
+  return fields_.value("startPage").toInt();
+}
@@ -0,0 +1,59 @@
+// File/EntryProbe.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// EntryProbe.H
+
+#ifndef ENTRYPROBE_H
+
+#define ENTRYPROBE_H
+
+#include <QString>
+#include <QVariant>
+#include <QDateTime>
+
+class EntryProbe {
+  /* An EntryProbe reads only what the TOC needs from an entry file: the
+     top-level scalar fields, the text of the title, and the sheet
+     numbers of the blocks. The contents of the blocks are skipped over
+     without being decoded, and no Data objects are created. This is safe
+     to do from any thread.
+     Journals are not replayed, so for an entry that has one, the result
+     may be out of date.
+  */
+public:
+  EntryProbe(QString fn);
+  bool ok() const { return ok_; }
+  QVariant value(QString key) const;
+  /* Returns a top-level scalar field, e.g., "stampTime". */
+  QString type() const;
+  QString uuid() const;
+  QDateTime created() const;
+  QDateTime modified() const;
+  int startPage() const;
+  QString titleText() const { return title_; }
+  int sheetCount() const { return maxSheet_ + 1; }
+  /* Same as EntryData::sheetCount(). */
+private:
+  void readChildren(class JSONByteParser &);
+  QString readTitle(class JSONByteParser &);
+private:
+  bool ok_;
+  QVariantMap fields_;
+  QString title_;
+  int maxSheet_;
+};
+
+#endif
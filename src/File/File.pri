@@ -10,14 +10,20 @@ HEADERS += \
      File/Downloader.h  \
      File/EntryFile.h  \
      File/Entry.h  \
+     File/EntryProbe.h  \
+     File/FileReader.h  \
+     File/FileWriter.h  \
      File/ImageLoader.h  \
+     File/JSONByteParser.h  \
      File/JSONFile.h  \
      File/JSONParser.h  \
+     File/JSONWriter.h  \
      File/LateNoteFile.h  \
      File/LateNoteManager.h  \
      File/PointerSet.h  \
      File/ResLoader.h  \
      File/RmDir.h  \
+     File/SaveScheduler.h  \
      File/SmartURL.h  \
      File/SvgFile.h  \
      File/VersionControl.h  \
@@ -30,14 +36,20 @@ SOURCES += \
      File/Downloader.cpp  \
      File/Entry.cpp  \
      File/EntryFile.cpp  \
+     File/EntryProbe.cpp  \
+     File/FileReader.cpp  \
+     File/FileWriter.cpp  \
      File/ImageLoader.cpp  \
+     File/JSONByteParser.cpp  \
      File/JSONFile.cpp  \
      File/JSONParser.cpp  \
+     File/JSONWriter.cpp  \
      File/LateNoteFile.cpp  \
      File/LateNoteManager.cpp  \
      File/PointerSet.cpp  \
      File/ResLoader.cpp  \
      File/RmDir.cpp  \
+     File/SaveScheduler.cpp  \
      File/SvgFile.cpp  \
      File/VersionControl.cpp  \
 
@@ -0,0 +1,109 @@
+// File/FileReader.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// FileReader.cpp
+
+#include "FileReader.h"
+#include "DataFile.h"
+#include "Data.h"
+
+FileReader *FileReader::instance() {
+  static FileReader *fr = new FileReader();
+  return fr;
+}
+
+FileReader::FileReader() {
+  current = 0;
+  lastQueued = 0;
+}
+
+FileReader::~FileReader() {
+}
+
+int FileReader::read(QString fn) {
+  Job job;
+  job.fn = fn;
+  { QMutexLocker l(&mutex);
+    job.id = ++lastQueued;
+    queue.enqueue(job);
+    jobQueued.wakeOne();
+  }
+  if (!isRunning())
+    start();
+  return job.id;
+}
+
+bool FileReader::isDone(int id) const {
+  QMutexLocker l(&mutex);
+  return done.contains(id);
+}
+
+Data *FileReader::take(int id) {
+  QString fn;
+  { QMutexLocker l(&mutex);
+    for (int k=0; k<queue.size(); k++) {
+      if (queue[k].id==id) {
+        fn = queue[k].fn;
+        queue.removeAt(k);
+        break;
+      }
+    }
+    if (fn.isEmpty()) {
+      while (current==id)
+        jobDone.wait(&mutex);
+      undelivered.removeOne(id);
+      return done.take(id);
+    }
+  }
+  // Not started yet, so we might as well do it ourselves
+  return DataFile0::parse(fn);
+}
+
+void FileReader::deliver() {
+  QList<int> ids;
+  QList<bool> oks;
+  { QMutexLocker l(&mutex);
+    foreach (int id, undelivered) {
+      ids << id;
+      oks << (done[id]!=0);
+    }
+    undelivered.clear();
+  }
+  for (int k=0; k<ids.size(); k++)
+    emit parsed(ids[k], oks[k]);
+}
+
+void FileReader::run() {
+  while (true) {
+    Job job;
+    { QMutexLocker l(&mutex);
+      while (queue.isEmpty())
+        jobQueued.wait(&mutex);
+      job = queue.dequeue();
+      current = job.id;
+    }
+    Data *data = DataFile0::parse(job.fn);
+    if (data)
+      data->moveToThread(thread());
+    { QMutexLocker l(&mutex);
+      done[job.id] = data;
+      undelivered << job.id;
+      current = 0;
+      jobDone.wakeAll();
+    }
+    QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+  }
+}
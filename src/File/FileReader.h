@@ -0,0 +1,72 @@
+// File/FileReader.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// FileReader.H
+
+#ifndef FILEREADER_H
+
+#define FILEREADER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QMap>
+#include <QList>
+#include <QString>
+
+class FileReader: public QThread {
+  /* FileReader reads and parses data files on a dedicated thread, in the
+     order in which they were requested. The resulting Data trees are
+     moved to the thread that owns the FileReader, i.e., the GUI thread,
+     before they are handed out. Completion is reported through the
+     parsed() signal; the tree must then be collected with take().
+  */
+  Q_OBJECT;
+public:
+  static FileReader *instance();
+  int read(QString fn);
+  /* Queues a read and returns an ID for it. */
+  class Data *take(int id);
+  /* Returns the parsed tree, or 0 if parsing failed. If the read has not
+     completed yet, this blocks until it has, or, if it has not even
+     started, parses the file right here. Each ID can be taken only once.
+     Whoever takes a tree owns it. */
+  bool isDone(int id) const;
+signals:
+  void parsed(int id, bool ok);
+private slots:
+  void deliver();
+private:
+  FileReader();
+  virtual ~FileReader();
+  virtual void run();
+private:
+  struct Job {
+    int id;
+    QString fn;
+  };
+  mutable QMutex mutex;
+  QWaitCondition jobQueued;
+  QWaitCondition jobDone;
+  QQueue<Job> queue;
+  int current; // ID of job being parsed, or 0
+  QMap<int, Data *> done;
+  QList<int> undelivered;
+  int lastQueued;
+};
+
+#endif
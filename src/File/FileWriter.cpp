@@ -0,0 +1,157 @@
+// File/FileWriter.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// FileWriter.cpp
+
+#include "FileWriter.h"
+#include "JSONFile.h"
+#include <QFile>
+#include <QDebug>
+
+FileWriter *FileWriter::instance() {
+  static FileWriter *fw = new FileWriter();
+  return fw;
+}
+
+FileWriter::FileWriter() {
+  lastQueued = 0;
+  lastDone = 0;
+  nBytesQueued = 0;
+}
+
+FileWriter::~FileWriter() {
+}
+
+int FileWriter::write(QString fn, QByteArray const &data, Mode mode) {
+  Job job;
+  job.fn = fn;
+  job.data = data;
+  job.mode = mode;
+  nBytesQueued += data.size();
+  { QMutexLocker l(&mutex);
+    job.id = ++lastQueued;
+    queue.enqueue(job);
+    jobQueued.wakeOne();
+  }
+  if (!isRunning())
+    start();
+  return job.id;
+}
+
+void FileWriter::waitFor(int id) {
+  { QMutexLocker l(&mutex);
+    while (lastDone < id)
+      jobDone.wait(&mutex);
+  }
+  deliver();
+}
+
+void FileWriter::waitForAll() {
+  int id;
+  { QMutexLocker l(&mutex);
+    id = lastQueued;
+  }
+  waitFor(id);
+}
+
+bool FileWriter::isIdle() const {
+  QMutexLocker l(&mutex);
+  return lastDone == lastQueued;
+}
+
+int FileWriter::lastId() const {
+  QMutexLocker l(&mutex);
+  return lastQueued;
+}
+
+qint64 FileWriter::bytesQueued() const {
+  return nBytesQueued;
+}
+
+void FileWriter::deliver() {
+  QList< QPair<int, bool> > res;
+  { QMutexLocker l(&mutex);
+    res = results;
+    results.clear();
+  }
+  for (int k=0; k<res.size(); k++)
+    emit written(res[k].first, res[k].second);
+}
+
+void FileWriter::run() {
+  while (true) {
+    Job job;
+    { QMutexLocker l(&mutex);
+      while (queue.isEmpty())
+        jobQueued.wait(&mutex);
+      job = queue.dequeue();
+    }
+    bool ok = perform(job.fn, job.data, job.mode);
+    { QMutexLocker l(&mutex);
+      results << QPair<int, bool>(job.id, ok);
+      lastDone = job.id;
+      jobDone.wakeAll();
+    }
+    QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+  }
+}
+
+bool FileWriter::perform(QString fn, QByteArray const &data, Mode mode) {
+  switch (mode) {
+  case Replace:
+    return JSONFile::saveUtf8(data, fn);
+  case ReplaceBinary: {
+    QFile f(fn);
+    if (f.exists()) {
+      QFile f0(fn + "~");
+      if (f0.exists())
+        f0.remove();
+      f.rename(fn + "~");
+      f.setFileName(fn);
+    }
+    if (!f.open(QFile::WriteOnly)) {
+      qDebug() << "FileWriter: Cannot open" << fn << "for writing";
+      return false;
+    }
+    if (f.write(data) != data.size()) {
+      qDebug() << "FileWriter: Failed to write" << fn;
+      return false;
+    }
+    return true;
+  }
+  case Append: {
+    QFile f(fn);
+    if (!f.open(QFile::WriteOnly | QFile::Append)) {
+      qDebug() << "FileWriter: Cannot open" << fn << "for appending";
+      return false;
+    }
+    if (f.write(data) != data.size()) {
+      qDebug() << "FileWriter: Failed to append to" << fn;
+      return false;
+    }
+    return true;
+  }
+  case Remove: {
+    QFile f(fn);
+    if (f.exists() && !f.remove()) {
+      qDebug() << "FileWriter: Cannot remove" << fn;
+      return false;
+    }
+    return true;
+  }
+  }
+  return false;
+}
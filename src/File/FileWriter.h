@@ -0,0 +1,82 @@
+// File/FileWriter.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// FileWriter.H
+
+#ifndef FILEWRITER_H
+
+#define FILEWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QPair>
+#include <QByteArray>
+#include <QString>
+
+class FileWriter: public QThread {
+  /* FileWriter performs file writes on a dedicated thread, in the order
+     in which they were requested. Completion is reported through the
+     written() signal, which is always emitted in the thread that owns
+     the FileWriter, i.e., the GUI thread.
+  */
+  Q_OBJECT;
+public:
+  enum Mode {
+    Replace, // write a new version, keeping the old one as FN~
+    ReplaceBinary, // same, but without JSONFile's trailing newline
+    Append,
+    Remove,
+  };
+public:
+  static FileWriter *instance();
+  int write(QString fn, QByteArray const &data, Mode mode=Replace);
+  /* Queues a write and returns an ID for it. */
+  void waitFor(int id);
+  /* Blocks until the given write has completed. The written() signals
+     of all completed writes are emitted before this returns. */
+  void waitForAll();
+  bool isIdle() const;
+  int lastId() const; // ID of most recently queued write
+  qint64 bytesQueued() const; // total since startup
+signals:
+  void written(int id, bool ok);
+private slots:
+  void deliver();
+private:
+  FileWriter();
+  virtual ~FileWriter();
+  virtual void run();
+  static bool perform(QString fn, QByteArray const &data, Mode mode);
+private:
+  struct Job {
+    int id;
+    QString fn;
+    QByteArray data;
+    Mode mode;
+  };
+  mutable QMutex mutex;
+  QWaitCondition jobQueued;
+  QWaitCondition jobDone;
+  QQueue<Job> queue;
+  QList< QPair<int, bool> > results;
+  int lastQueued;
+  int lastDone;
+  qint64 nBytesQueued; // only accessed from our owner's thread
+};
+
+#endif
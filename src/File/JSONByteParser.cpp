@@ -0,0 +1,524 @@
+// File/JSONByteParser.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// JSONByteParser.C
+
+#include "JSONByteParser.h"
+#include <QDebug>
+#include <string.h>
+#include <limits>
+
+namespace {
+  /* Word-at-a-time helpers. Each of the "has..." functions returns nonzero
+     if at least one of the eight bytes in the word satisfies the condition.
+     Callers only use them to skip over boring stretches of input and
+     rescan any interesting word one byte at a time, so they do not care
+     which byte triggered, nor about the byte order of the machine. */
+  quint64 const ones = 0x0101010101010101ULL;
+  quint64 const highs = 0x8080808080808080ULL;
+  quint64 const spaces = ones * ' ';
+
+  inline quint64 load8(char const *p) {
+    quint64 w;
+    memcpy(&w, p, 8);
+    return w;
+  }
+
+  inline quint64 hasZeroByte(quint64 w) {
+    return (w - ones) & ~w & highs;
+  }
+
+  inline quint64 hasByte(quint64 w, unsigned char c) {
+    return hasZeroByte(w ^ (ones * c));
+  }
+
+  inline quint64 hasByteBelow(quint64 w, unsigned char c) {
+    // valid for c <= 128
+    return (w - ones * c) & ~w & highs;
+  }
+
+  inline bool isSpecialInString(quint64 w) {
+    return hasByte(w, '"') || hasByte(w, '\\') || hasByteBelow(w, ' ');
+  }
+
+  inline int hexValue(char c) {
+    if (c>='0' && c<='9')
+      return c - '0';
+    else if (c>='A' && c<='F')
+      return 10 + c - 'A';
+    else if (c>='a' && c<='f')
+      return 10 + c - 'a';
+    else
+      return -1;
+  }
+
+  double const powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  bool fastDouble(char const *p, char const *e, double &result) {
+    /* Parses plain decimals like "-12.375" exactly, without going through
+       a string conversion. This works because for up to 15 significant
+       digits, the digits form an integer that is exactly representable
+       as a double, as is any power of ten up to 1e22, so a single
+       (correctly rounded) division gives the correctly rounded result.
+       Returns false for anything else, including exponents. */
+    bool neg = false;
+    if (p<e && *p=='-') {
+      neg = true;
+      p++;
+    }
+    qint64 mant = 0;
+    int ndig = 0;
+    int nfrac = 0;
+    bool dot = false;
+    for (; p<e; p++) {
+      char c = *p;
+      if (c>='0' && c<='9') {
+        mant = 10*mant + (c - '0');
+        if (++ndig > 15)
+          return false;
+        if (dot)
+          nfrac++;
+      } else if (c=='.' && !dot && ndig>0) {
+        dot = true;
+      } else {
+        return false;
+      }
+    }
+    if (!dot || nfrac==0)
+      return false;
+    result = double(mant) / powersOfTen[nfrac];
+    if (neg)
+      result = -result;
+    return true;
+  }
+};
+
+JSONByteParser::JSONByteParser(QByteArray const &utf8): input(utf8) {
+  start = input.constData();
+  ptr = start;
+  end = start + input.size();
+  if (end-ptr>=3 && memcmp(ptr, "\xef\xbb\xbf", 3)==0)
+    ptr += 3; // skip byte order mark, as QTextStream would
+}
+
+void JSONByteParser::makeError(QString msg, bool atPrev) const {
+  int l = 1;
+  char const *lineStart = start;
+  for (char const *p=start; p<ptr; p++) {
+    if (*p=='\n' || (*p=='\r' && !(p+1<ptr && p[1]=='\n'))) {
+      l++;
+      lineStart = p + 1;
+    }
+  }
+  int c = ptr - lineStart;
+  if (atPrev)
+    if (--c<0)
+      l--;
+  throw Error(msg, l, c);
+}
+
+bool JSONByteParser::atEnd() const throw() {
+  return ptr>=end;
+}
+
+void JSONByteParser::assertEnd() const {
+  if (!atEnd())
+    makeError("Expected EOF");
+}
+
+void JSONByteParser::assertNext() const {
+  if (atEnd())
+    makeError("Unexpected EOF");
+}
+
+void JSONByteParser::assertTermination(char const *msg) const {
+  /* Like JSONParser, we refuse literals and numbers that run straight
+     into letters or digits. */
+  if (atEnd())
+    return;
+  unsigned char c = *ptr;
+  bool bad;
+  if (c<0x80) {
+    bad = (c>='0' && c<='9') || (c>='a' && c<='z') || (c>='A' && c<='Z');
+  } else {
+    int n = end - ptr;
+    QString s = QString::fromUtf8(ptr, n<4 ? n : 4);
+    bad = !s.isEmpty() && s[0].isLetterOrNumber();
+  }
+  if (bad)
+    makeError(msg);
+}
+
+char JSONByteParser::peekNext() const {
+  assertNext();
+  char r = *ptr;
+  if (r=='\r')
+    r = '\n';
+  return r;
+}
+
+char JSONByteParser::getNext() {
+  assertNext();
+  char r = *ptr++;
+  if (r=='\r') {
+    if (ptr<end && *ptr=='\n')
+      ptr++;
+    r = '\n';
+  }
+  return r;
+}
+
+void JSONByteParser::skipWhite() throw() {
+  while (ptr<end) {
+    switch (*ptr) {
+    case ' ':
+      ptr++;
+      // Indentation comes in long runs of spaces, so take big steps
+      while (end-ptr>=8 && load8(ptr)==spaces)
+        ptr += 8;
+      break;
+    case '\t': case '\n': case '\r':
+      ptr++;
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+bool JSONByteParser::conditionalReadLiteral(char const *s, int len) {
+  if (end-ptr>=len && memcmp(ptr, s, len)==0) {
+    ptr += len;
+    if (atEnd())
+      return true;
+    assertTermination("Bad termination of literal value");
+    skipWhite();
+    return true;
+  } else {
+    return false;
+  }
+}
+
+QString JSONByteParser::readString() {
+  if (getNext()!='"')
+    makeError("Expected a string", true);
+  QString res;
+  char const *run = ptr; // start of current stretch of plain bytes
+  while (true) {
+    while (end-ptr>=8 && !isSpecialInString(load8(ptr)))
+      ptr += 8;
+    assertNext();
+    unsigned char c = *ptr;
+    if (c=='"') {
+      break;
+    } else if (c<' ') {
+      ptr++;
+      makeError("Illegal control char inside string", true);
+    } else if (c=='\\') {
+      if (ptr>run)
+        res += QString::fromUtf8(run, ptr-run);
+      ptr++;
+      switch (getNext()) {
+      case 'b': res += '\b'; break;
+      case 'f': res += '\f'; break;
+      case 'n': res += '\n'; break;
+      case 'r': res += '\r'; break;
+      case 't': res += '\t'; break;
+      case '\\': res += '\\'; break;
+      case '/': res += '/'; break;
+      case '"': res += '"'; break;
+      case 'u': {
+        int a = 0;
+        for (int k=0; k<4; k++) {
+          int x = hexValue(getNext());
+          if (x<0)
+            makeError("Bad hex digit in unicode escape", true);
+          a = (a<<4) + x;
+        }
+        res += QChar(a);
+      } break;
+      default:
+        makeError("Unexpected character after backslash", true);
+      }
+      run = ptr;
+    } else {
+      ptr++;
+    }
+  }
+  if (ptr>run)
+    res += QString::fromUtf8(run, ptr-run);
+  ptr++; // skip closing quote
+  skipWhite();
+  if (res.isNull())
+    res = QLatin1String("");
+  return res;
+}
+
+QVariant JSONByteParser::readNumber() {
+  char const *p0 = ptr;
+  bool isInt = true;
+  while (ptr<end) {
+    char c = *ptr;
+    if (c>='0' && c<='9') {
+      ptr++;
+    } else if (c=='e' || c=='E' || c=='.' || c=='+' || c=='-') {
+      isInt = false;
+      ptr++;
+    } else {
+      break;
+    }
+  }
+  if (ptr==p0)
+    makeError("Expected a number");
+  char const *p1 = ptr;
+  assertTermination("Expected a number");
+
+  skipWhite();
+
+  if (isInt) {
+    /* Like QString::toInt(), which JSONParser uses, we return zero
+       for numbers that do not fit. */
+    qint64 v = 0;
+    for (char const *p=p0; p<p1; p++) {
+      v = 10*v + (*p - '0');
+      if (v > std::numeric_limits<int>::max()) {
+        v = 0;
+        break;
+      }
+    }
+    return QVariant(int(v));
+  }
+
+  double v;
+  if (fastDouble(p0, p1, v))
+    return QVariant(v);
+
+  bool ok;
+  v = QByteArray::fromRawData(p0, p1-p0).toDouble(&ok);
+  if (!ok)
+    makeError("Expected a number");
+  return QVariant(v);
+}
+
+QVariant JSONByteParser::readValue(char const *exp) {
+  char c = peekNext();
+  if (c=='"')
+    return QVariant(readString());
+  else if (c=='-' || (c>='0' && c<='9'))
+    return readNumber();
+  else if (conditionalReadLiteral("false", 5))
+    return QVariant(false);
+  else if (conditionalReadLiteral("true", 4))
+    return QVariant(true);
+  else if (conditionalReadLiteral("null", 4))
+    return QVariant();
+  else
+    makeError(QString("Expected a ") + exp, false);
+  return QVariant(); // not executed
+}
+
+bool JSONByteParser::enterObject() {
+  if (getNext()!='{')
+    makeError("Not an object", true);
+  skipWhite();
+  return !conditionalReadLiteral("}", 1);
+}
+
+QString JSONByteParser::readKey() {
+  QString key = readString();
+  if (getNext()!=':')
+    makeError("Expected colon");
+  skipWhite();
+  return key;
+}
+
+bool JSONByteParser::nextMember() {
+  switch (getNext()) {
+  case '}':
+    skipWhite();
+    return false;
+  case ',':
+    skipWhite();
+    return true;
+  default:
+    makeError("Expected comma or closing brace", true);
+  }
+  return false; // not executed
+}
+
+bool JSONByteParser::enterArray() {
+  if (getNext()!='[')
+    makeError("Not an array", true);
+  skipWhite();
+  return !conditionalReadLiteral("]", 1);
+}
+
+bool JSONByteParser::nextElement() {
+  switch (getNext()) {
+  case ']':
+    skipWhite();
+    return false;
+  case ',':
+    skipWhite();
+    return true;
+  default:
+    makeError("Expected comma or closing bracket", true);
+  }
+  return false; // not executed
+}
+
+QVariantMap JSONByteParser::readObject() {
+  QVariantMap res;
+  if (enterObject()) {
+    do {
+      QString key = readKey();
+      res.insert(key, readAny());
+    } while (nextMember());
+  }
+  return res;
+}
+
+QVariantList JSONByteParser::readArray() {
+  QVariantList res;
+  if (enterArray()) {
+    do {
+      res.append(readAny());
+    } while (nextElement());
+  }
+  return res;
+}
+
+QVariant JSONByteParser::readAny() {
+  switch (peekNext()) {
+  case '{':
+    return QVariant(readObject());
+  case '[':
+    return QVariant(readArray());
+  default:
+    return readValue("value, object, or array");
+  }
+}
+
+void JSONByteParser::skipString() {
+  if (getNext()!='"')
+    makeError("Expected a string", true);
+  while (true) {
+    while (end-ptr>=8) {
+      quint64 w = load8(ptr);
+      if (hasByte(w, '"') || hasByte(w, '\\'))
+        break;
+      ptr += 8;
+    }
+    char c = getNext();
+    if (c=='"')
+      return;
+    else if (c=='\\')
+      getNext();
+  }
+}
+
+void JSONByteParser::skipAny() {
+  /* Nested objects and arrays are skipped by counting brackets, so we
+     check only that strings are terminated and brackets balance. */
+  char c = peekNext();
+  if (c!='{' && c!='[') {
+    if (c=='"') {
+      skipString();
+      skipWhite();
+    } else {
+      readValue("value, object, or array");
+    }
+    return;
+  }
+  int depth = 0;
+  do {
+    c = peekNext();
+    if (c=='"') {
+      skipString();
+    } else {
+      ptr++;
+      if (c=='{' || c=='[')
+        depth++;
+      else if (c=='}' || c==']')
+        depth--;
+      else if (c==' ')
+        skipWhite();
+    }
+  } while (depth>0);
+  skipWhite();
+}
+
+#if 0
+// Parse-throughput benchmark. Build with
+//   qmake, adding this file, JSONParser.cpp, and JSONFile.cpp to SOURCES,
+// then run as "jsonbench PATH/pages/*.json".
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+  QStringList args = app.arguments();
+  args.removeFirst();
+  QList<QByteArray> files;
+  qint64 bytes = 0;
+  for (QString fn: args) {
+    QFile f(fn);
+    if (f.open(QFile::ReadOnly)) {
+      files << f.readAll();
+      bytes += files.last().size();
+    }
+  }
+  qDebug() << "Read" << files.size() << "files," << bytes << "bytes";
+
+  int const N = 5;
+  QElapsedTimer t;
+
+  t.start();
+  QList<QVariantMap> ref;
+  for (int k=0; k<N; k++) {
+    ref.clear();
+    for (QByteArray const &ba: files) {
+      QTextStream ts(ba);
+      ts.setCodec("UTF-8");
+      JSONParser p(ts.readAll());
+      ref << p.readObject();
+    }
+  }
+  double t_old = t.elapsed() / 1e3 / N;
+
+  t.start();
+  QList<QVariantMap> res;
+  for (int k=0; k<N; k++) {
+    res.clear();
+    for (QByteArray const &ba: files) {
+      JSONByteParser p(ba);
+      res << p.readObject();
+    }
+  }
+  double t_new = t.elapsed() / 1e3 / N;
+
+  qDebug() << "QString parser:" << bytes/t_old/1e6 << "MB/s";
+  qDebug() << "Byte parser:   " << bytes/t_new/1e6 << "MB/s";
+  qDebug() << "Results identical:" << (ref==res);
+  return 0;
+}
+#endif
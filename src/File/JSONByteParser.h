@@ -0,0 +1,84 @@
+// File/JSONByteParser.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// JSONByteParser.H
+
+#ifndef JSONBYTEPARSER_H
+
+#define JSONBYTEPARSER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+#include "JSONParser.h"
+
+class JSONByteParser {
+  /* A JSONByteParser does the same job as a JSONParser, and produces
+     identical results, but it works directly on the raw UTF-8 bytes
+     of a file rather than on a decoded QString. Whitespace and string
+     bodies are scanned eight bytes at a time, and numbers are parsed
+     in place.
+     Line and column numbers are only computed when an error is
+     reported. Columns are counted in bytes rather than in characters.
+  */
+public:
+  typedef JSONParser::Error Error;
+public:
+  JSONByteParser(QByteArray const &utf8);
+  bool atEnd() const throw();
+  QVariantMap readObject();
+  QVariantList readArray();
+  QVariant readAny();
+  void assertEnd() const;
+public:
+  /* Incremental reading, for callers that want to consume an object or
+     array one member at a time rather than have it built in memory.
+     Typical use:
+       if (p.enterObject()) {
+         do {
+           QString key = p.readKey();
+           ... read the value with readAny(), enterArray(), etc. ...
+         } while (p.nextMember());
+       }
+  */
+  bool enterObject(); // consumes "{"; false if the object is empty
+  QString readKey(); // consumes a key and its colon
+  bool nextMember(); // consumes "," (true) or "}" (false)
+  bool enterArray(); // consumes "["; false if the array is empty
+  bool nextElement(); // consumes "," (true) or "]" (false)
+  char peekNext() const;
+  void skipAny();
+  /* Consumes a value of any type without building it. Nested values
+     are not fully validated. */
+protected:
+  QString readString();
+  void skipString();
+  QVariant readNumber();
+  QVariant readValue(char const *exp="value");
+  void skipWhite() throw();
+  char getNext();
+  bool conditionalReadLiteral(char const *s, int len);
+  void assertTermination(char const *msg) const;
+  void assertNext() const;
+  void makeError(QString msg, bool atPrev=false) const;
+private:
+  QByteArray input; // keeps the data alive; we only use the pointers below
+  char const *start;
+  char const *ptr;
+  char const *end;
+};
+
+#endif
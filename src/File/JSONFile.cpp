@@ -21,150 +21,12 @@
 #include <QDebug>
 
 #include "JSONParser.h"
+#include "JSONByteParser.h"
+#include "JSONWriter.h"
   
 
 namespace JSONFile {
 
-  /* The following portion of this file has been adapted from the source code of
-     qjson. The following copyright message applies:
-   */
-/* This file is part of qjson
-  *
-  * Copyright (C) 2009 Till Adam <adam@kde.org>
-  * Copyright (C) 2009 Flavio Castelli <flavio@castelli.name>
-  *
-  * This library is free software; you can redistribute it and/or
-  * modify it under the terms of the GNU Library General Public
-  * License as published by the Free Software Foundation; either
-  * version 2 of the License, or (at your option) any later version.
-  *
-  * This library is distributed in the hope that it will be useful,
-  * but WITHOUT ANY WARRANTY; without even the implied warranty of
-  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
-  * Library General Public License for more details.
-  *
-  * You should have received a copy of the GNU Library General Public License
-  * along with this library; see the file COPYING.LIB.  If not, write to
-  * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
-  * Boston, MA 02110-1301, USA.
-  */
-  class Serializer {
-  public:
-    Serializer(bool compact=false): compact(compact) { }
-    QString serializeMap(QVariantMap const &v,
-                         int indent, bool parentIsArray);  
-    QString serializeList(QVariantList const &v,
-                          int indent, bool parentIsArray);
-    QString serializeString(QString s);
-    QString serializeDouble(double v);
-    QString serialize(QVariant v,
-                      int indent=0, bool parentIsArray=false);
-  private:
-    bool compact;
-  };
-
-  QString Serializer::serializeMap(QVariantMap const &v,
-                                   int indent, bool parentIsArray) {
-    if (v.isEmpty())
-      return compact ? "{}" : "{ }";
-    QString ind = "";
-    if (!compact) 
-      for (int k=0; k<indent; k++)
-        ind += "  ";
-    QString s = compact ? "{"
-      : (parentIsArray ? "{ " : "{\n" + ind + "  ");
-    bool first = true;
-    QList<QString> kk = v.keys();
-    // do a little reordering
-    if (kk.removeOne("mod"))
-      kk.insert(0, "mod");
-    if (kk.removeOne("cre"))
-      kk.insert(0, "cre");
-    if (kk.removeOne("typ"))
-      kk.insert(0, "typ");
-    if (kk.removeOne("cc"))
-      kk.append("cc");
-    foreach (QString k, kk) {
-      if (first)
-	first = false;
-      else
-	s += compact ? ",\n" : (",\n" + ind + "  ");
-      s += serializeString(k);
-      s += compact ? ":" : ": ";
-      QString s1 = serialize(v[k], indent+1, false);
-      // lastML = s1.contains("\n");
-      s += s1;
-    }
-    s += compact ? "}" : ("\n" + ind + "}");
-    return s;
-  }
-
-  QString Serializer::serializeList(QVariantList const &v,
-                                    int indent, bool parentIsArray) {
-    if (v.isEmpty())
-      return compact ? "[]" : "[ ]";
-    QString ind = "";
-    if (!compact)
-      for (int k=0; k<indent; k++)
-        ind += "  ";
-    QString s = compact ? "[" : (parentIsArray ? "[ " : "[\n" + ind + "  ");
-    bool first = true;
-    foreach (QVariant k, v) {
-      if (first)
-	first = false;
-      else
-	s += compact ? "," : (",\n" + ind + "  ");
-      QString s1 = serialize(k, indent+1, true);
-      s += s1;
-    }
-    s += compact ? "]" : ("\n" + ind + "]");
-    return s;
-  }
-
-  QString Serializer::serializeString(QString s) {
-    s.replace("\\", "\\\\");
-    s.replace("\"", "\\\"");
-    s.replace("\b", "\\b");
-    s.replace("\f", "\\f");
-    s.replace("\n", "\\n");
-    s.replace("\r", "\\r");
-    s.replace("\t", "\\t");
-    return "\"" + s + "\"";
-  }
-
-  QString Serializer::serializeDouble(double d) {
-    QString s = QString::number(d);
-    if (!s.contains(".") && !s.contains("e"))
-      s += ".0";
-    return s;
-  }
-  
-  QString Serializer::serialize(QVariant v, int indent, bool parentIsArray) {
-    if (!v.isValid())
-      return QString(); // invalid
-    if (v.type()==QVariant::List) 
-      return serializeList(v.toList(), indent, parentIsArray);
-    else if (v.type()==QVariant::Map)
-      return serializeMap(v.toMap(), indent, parentIsArray);
-    else if (v.type()==QVariant::String || v.type()==QVariant::ByteArray)
-      return serializeString(v.toString());
-    else if (v.type()==QVariant::Double)
-      return serializeDouble(v.toDouble());
-    else if (v.type()==QVariant::Bool)
-      return v.toBool() ? "true" : "false";
-    else if (v.type() == QVariant::ULongLong )
-      return QString::number(v.value<qulonglong>());
-    else if (v.canConvert<qlonglong>())
-      return QString::number(v.value<qlonglong>());
-    else if (v.canConvert<QString>())
-      // this will catch QDate, QDateTime, QUrl, ...
-      return serializeString(v.toString());
-    else
-      return QString();
-  }
-
-  /* End of adapted section. The rest of this file was written by Daniel Wagenaar. */
-
   QVariantMap load(QString fn, bool *ok) {
     if (ok)
       *ok = false;
@@ -175,9 +37,7 @@ namespace JSONFile {
     }
 
     bool ok1;
-    QTextStream ts(&f);
-    ts.setCodec("UTF-8");
-    QVariantMap res = read(ts.readAll(), &ok1);
+    QVariantMap res = readUtf8(f.readAll(), &ok1);
     if (!ok1) 
       qDebug() << "(while reading: " << fn << ")";
     if (ok)
@@ -201,17 +61,38 @@ namespace JSONFile {
     }
   }
 
+  QVariantMap readUtf8(QByteArray const &json, bool *ok) {
+    if (ok)
+      *ok = false;
+    JSONByteParser parser(json);
+    try {
+      QVariantMap v = parser.readObject();
+      parser.assertEnd();
+      if (ok)
+	*ok = true;
+      return v;
+    } catch (JSONByteParser::Error const &e) {
+      e.report();
+      return QVariantMap();
+    }
+  }
+
   QString write(QVariantMap const &src, bool compact) {
-    Serializer s(compact);
-    return s.serialize(src, 0, true);
+    QByteArray ba;
+    JSONWriter w(ba, compact);
+    w.writeValue(src);
+    return QString::fromUtf8(ba);
   }
   
   bool save(QVariantMap const &src, QString fn, bool compact) {
-    //    QJson::Serializer s;
-    //    QByteArray ba = s.serialize(QVariant(src));
-    Serializer s(compact);
-    QByteArray ba = s.serialize(src, 0, true).toUtf8();
-    if (ba.isEmpty()) {  
+    QByteArray ba;
+    JSONWriter w(ba, compact);
+    w.writeValue(src);
+    return saveUtf8(ba, fn);
+  }
+
+  bool saveUtf8(QByteArray const &json, QString fn) {
+    if (json.isEmpty()) {  
       qDebug() << "DataFile0: Serialization failed";
       return false;
       /* Note that the serializer currently only handles
@@ -223,14 +104,8 @@ namespace JSONFile {
 	 In addition, anything that QVariant can convert to a QString is
 	 supported. That includes QDateTime, QUrl, and some others.
 	 However, QPoint, QFont, etc., are not supported.
-	 Qt5 will have native JSON support, and I will likely switch to
-	 using that eventually.
       */
-    
-      /* As an aside, I discovered that the serializer puts a binary length
-	 marker in front of the json data if it writes directly to file. */
     }
-    ba += "\n";
   
     QFile f(fn);
   
@@ -248,7 +123,7 @@ namespace JSONFile {
       return false;
     }
 
-    if (f.write(ba) != ba.size()) {
+    if (f.write(json) != json.size() || f.write("\n", 1) != 1) {
       qDebug() << "JSONFile: Failed to write all contents";
       return false;
     }
@@ -25,8 +25,12 @@
 namespace JSONFile {
   QVariantMap load(QString fn, bool *ok=0);
   QVariantMap read(QString json, bool *ok=0);
+  QVariantMap readUtf8(QByteArray const &json, bool *ok=0);
   bool save(QVariantMap const &src, QString fn, bool compact=false);
   QString write(QVariantMap const &src, bool compact=false);
+  bool saveUtf8(QByteArray const &json, QString fn);
+  /* Writes JSON that has already been encoded, e.g., by a JSONWriter,
+     keeping the previous version of the file as FN~. */
 };
 
 #endif
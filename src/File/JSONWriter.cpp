@@ -0,0 +1,329 @@
+// File/JSONWriter.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// JSONWriter.C
+
+/* The output format and the handling of the various QVariant types
+   follow the serializer that JSONFile used to contain, which had been
+   adapted from the source code of qjson. The following copyright message
+   applies to that:
+ */
+/* This file is part of qjson
+  *
+  * Copyright (C) 2009 Till Adam <adam@kde.org>
+  * Copyright (C) 2009 Flavio Castelli <flavio@castelli.name>
+  *
+  * This library is free software; you can redistribute it and/or
+  * modify it under the terms of the GNU Library General Public
+  * License as published by the Free Software Foundation; either
+  * version 2 of the License, or (at your option) any later version.
+  *
+  * This library is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  * Library General Public License for more details.
+  *
+  * You should have received a copy of the GNU Library General Public License
+  * along with this library; see the file COPYING.LIB.  If not, write to
+  * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  * Boston, MA 02110-1301, USA.
+  */
+
+#include "JSONWriter.h"
+#include "ElnAssert.h"
+
+JSONWriter::JSONWriter(QByteArray &dst, bool compact, int baseDepth):
+  dst(dst), compact(compact), base(baseDepth) {
+}
+
+QStringList JSONWriter::orderedKeys(QVariantMap const &v) {
+  QStringList kk = v.keys();
+  // do a little reordering
+  if (kk.removeOne("mod"))
+    kk.insert(0, "mod");
+  if (kk.removeOne("cre"))
+    kk.insert(0, "cre");
+  if (kk.removeOne("typ"))
+    kk.insert(0, "typ");
+  if (kk.removeOne("cc"))
+    kk.append("cc");
+  return kk;
+}
+
+void JSONWriter::writeIndent(int indent) {
+  static char const spaces[] = "                                ";
+  int n = 2*indent;
+  while (n>0) {
+    int m = n < int(sizeof(spaces))-1 ? n : int(sizeof(spaces))-1;
+    dst.append(spaces, m);
+    n -= m;
+  }
+}
+
+void JSONWriter::beginValue(bool &parentIsArray) {
+  /* Writes whatever needs to precede a value: nothing at top level or
+     after a key; the opening bracket or a comma in an array. */
+  if (stack.isEmpty()) {
+    parentIsArray = true;
+    return;
+  }
+  Frame &f = stack.last();
+  if (!f.isArray) {
+    parentIsArray = false;
+    return;
+  }
+  int indent = base + stack.size() - 1;
+  if (f.count==0) {
+    if (compact)
+      dst += '[';
+    else if (f.parentIsArray)
+      dst += "[ ";
+    else {
+      dst += "[\n";
+      writeIndent(indent);
+      dst += "  ";
+    }
+  } else {
+    if (compact) {
+      dst += ',';
+    } else {
+      dst += ",\n";
+      writeIndent(indent);
+      dst += "  ";
+    }
+  }
+  f.count++;
+  parentIsArray = true;
+}
+
+void JSONWriter::openFrame(bool isArray) {
+  Frame f;
+  f.isArray = isArray;
+  beginValue(f.parentIsArray);
+  f.count = 0;
+  stack.append(f);
+}
+
+void JSONWriter::closeFrame(bool isArray) {
+  ASSERT(!stack.isEmpty());
+  Frame f = stack.takeLast();
+  ASSERT(f.isArray==isArray);
+  if (f.count==0) {
+    if (compact)
+      dst += isArray ? "[]" : "{}";
+    else
+      dst += isArray ? "[ ]" : "{ }";
+  } else {
+    if (!compact) {
+      dst += '\n';
+      writeIndent(base + stack.size());
+    }
+    dst += isArray ? ']' : '}';
+  }
+}
+
+void JSONWriter::beginObject() {
+  openFrame(false);
+}
+
+void JSONWriter::endObject() {
+  closeFrame(false);
+}
+
+void JSONWriter::beginArray() {
+  openFrame(true);
+}
+
+void JSONWriter::endArray() {
+  closeFrame(true);
+}
+
+void JSONWriter::writeKey(QString const &k) {
+  ASSERT(!stack.isEmpty());
+  Frame &f = stack.last();
+  ASSERT(!f.isArray);
+  int indent = base + stack.size() - 1;
+  if (f.count==0) {
+    if (compact)
+      dst += '{';
+    else if (f.parentIsArray)
+      dst += "{ ";
+    else {
+      dst += "{\n";
+      writeIndent(indent);
+      dst += "  ";
+    }
+  } else {
+    if (compact) {
+      dst += ",\n";
+    } else {
+      dst += ",\n";
+      writeIndent(indent);
+      dst += "  ";
+    }
+  }
+  f.count++;
+  writeString(k);
+  dst += compact ? ":" : ": ";
+}
+
+void JSONWriter::writeValue(QVariant const &v) {
+  bool parentIsArray;
+  beginValue(parentIsArray);
+  writeVariant(v, base + stack.size(), parentIsArray);
+}
+
+void JSONWriter::writeRaw(QByteArray const &json) {
+  bool parentIsArray;
+  beginValue(parentIsArray);
+  dst += json;
+}
+
+void JSONWriter::writeMap(QVariantMap const &v,
+                          int indent, bool parentIsArray) {
+  if (v.isEmpty()) {
+    dst += compact ? "{}" : "{ }";
+    return;
+  }
+  if (compact) {
+    dst += '{';
+  } else if (parentIsArray) {
+    dst += "{ ";
+  } else {
+    dst += "{\n";
+    writeIndent(indent);
+    dst += "  ";
+  }
+  bool first = true;
+  foreach (QString const &k, orderedKeys(v)) {
+    if (first) {
+      first = false;
+    } else if (compact) {
+      dst += ",\n";
+    } else {
+      dst += ",\n";
+      writeIndent(indent);
+      dst += "  ";
+    }
+    writeString(k);
+    dst += compact ? ":" : ": ";
+    writeVariant(v[k], indent+1, false);
+  }
+  if (!compact) {
+    dst += '\n';
+    writeIndent(indent);
+  }
+  dst += '}';
+}
+
+void JSONWriter::writeList(QVariantList const &v,
+                           int indent, bool parentIsArray) {
+  if (v.isEmpty()) {
+    dst += compact ? "[]" : "[ ]";
+    return;
+  }
+  if (compact) {
+    dst += '[';
+  } else if (parentIsArray) {
+    dst += "[ ";
+  } else {
+    dst += "[\n";
+    writeIndent(indent);
+    dst += "  ";
+  }
+  bool first = true;
+  foreach (QVariant const &x, v) {
+    if (first) {
+      first = false;
+    } else if (compact) {
+      dst += ',';
+    } else {
+      dst += ",\n";
+      writeIndent(indent);
+      dst += "  ";
+    }
+    writeVariant(x, indent+1, true);
+  }
+  if (!compact) {
+    dst += '\n';
+    writeIndent(indent);
+  }
+  dst += ']';
+}
+
+static inline void appendEscaped(QByteArray &dst, char c) {
+  switch (c) {
+  case '\\': dst += "\\\\"; break;
+  case '"': dst += "\\\""; break;
+  case '\b': dst += "\\b"; break;
+  case '\f': dst += "\\f"; break;
+  case '\n': dst += "\\n"; break;
+  case '\r': dst += "\\r"; break;
+  case '\t': dst += "\\t"; break;
+  default: dst += c; break;
+  }
+}
+
+void JSONWriter::writeString(QString const &s) {
+  /* All escaped characters are ASCII, and UTF-8 never uses ASCII bytes
+     inside multibyte sequences, so we can escape after encoding. Most
+     strings are pure ASCII, and for those we do not even need to
+     encode. */
+  dst += '"';
+  int n = s.size();
+  QChar const *p = s.constData();
+  for (int i=0; i<n; i++) {
+    ushort u = p[i].unicode();
+    if (u>=0x80) {
+      QByteArray rest = s.midRef(i).toUtf8();
+      for (char c: rest)
+        appendEscaped(dst, c);
+      break;
+    }
+    appendEscaped(dst, char(u));
+  }
+  dst += '"';
+}
+
+void JSONWriter::writeDouble(double d) {
+  QString s = QString::number(d);
+  if (!s.contains(".") && !s.contains("e"))
+    s += ".0";
+  dst += s.toLatin1();
+}
+
+void JSONWriter::writeVariant(QVariant const &v,
+                              int indent, bool parentIsArray) {
+  if (!v.isValid())
+    return; // invalid
+  if (v.type()==QVariant::List)
+    writeList(v.toList(), indent, parentIsArray);
+  else if (v.type()==QVariant::Map)
+    writeMap(v.toMap(), indent, parentIsArray);
+  else if (v.type()==QVariant::String || v.type()==QVariant::ByteArray)
+    writeString(v.toString());
+  else if (v.type()==QVariant::Double)
+    writeDouble(v.toDouble());
+  else if (v.type()==QVariant::Bool)
+    dst += v.toBool() ? "true" : "false";
+  else if (v.type() == QVariant::ULongLong)
+    dst += QByteArray::number(v.value<qulonglong>());
+  else if (v.canConvert<qlonglong>())
+    dst += QByteArray::number(v.value<qlonglong>());
+  else if (v.canConvert<QString>())
+    // this will catch QDate, QDateTime, QUrl, ...
+    writeString(v.toString());
+}
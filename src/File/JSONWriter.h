@@ -0,0 +1,84 @@
+// File/JSONWriter.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// JSONWriter.H
+
+#ifndef JSONWRITER_H
+
+#define JSONWRITER_H
+
+#include <QByteArray>
+#include <QVariant>
+#include <QVector>
+#include <QStringList>
+
+class JSONWriter {
+  /* A JSONWriter appends UTF-8 encoded JSON to a QByteArray. Objects and
+     arrays can be written piecemeal with beginObject()/writeKey()/
+     endObject() and beginArray()/endArray(), or in one go by passing
+     a QVariantMap or QVariantList to writeValue(). Either way, the
+     output is formatted exactly as JSONFile always has, so that files
+     written by different versions of eln diff cleanly.
+     Keys are written in the order given. It is up to the caller to
+     follow JSONFile's convention of putting "typ", "cre", and "mod"
+     first and "cc" last; writeValue() does this for QVariantMaps.
+  */
+public:
+  JSONWriter(QByteArray &dst, bool compact=false, int baseDepth=0);
+  /* BASEDEPTH lets a value be encoded separately for later use with
+     writeRaw() at that depth. */
+  void beginObject();
+  void writeKey(QString const &);
+  void endObject();
+  void beginArray();
+  void endArray();
+  void writeValue(QVariant const &);
+  /* Writes a complete value as an array element, as the value for the
+     most recently written key, or at top level. */
+  void writeRaw(QByteArray const &json);
+  /* Like writeValue, but for a value that is already encoded. It must
+     have been encoded at the same nesting depth for the indentation to
+     come out right. */
+  int depth() const { return base + stack.size(); }
+  bool isCompact() const { return compact; }
+  QByteArray &buffer() { return dst; }
+  static QStringList orderedKeys(QVariantMap const &);
+  /* Returns the keys of a map in the order in which we write them:
+     "typ", "cre", "mod", then the rest alphabetically, and "cc" last. */
+private:
+  struct Frame {
+    bool isArray;
+    bool parentIsArray;
+    int count;
+  };
+private:
+  void beginValue(bool &parentIsArray);
+  void openFrame(bool isArray);
+  void closeFrame(bool isArray);
+  void writeIndent(int indent);
+  void writeVariant(QVariant const &v, int indent, bool parentIsArray);
+  void writeMap(QVariantMap const &v, int indent, bool parentIsArray);
+  void writeList(QVariantList const &v, int indent, bool parentIsArray);
+  void writeString(QString const &s);
+  void writeDouble(double d);
+private:
+  QByteArray &dst;
+  bool compact;
+  int base;
+  QVector<Frame> stack;
+};
+
+#endif
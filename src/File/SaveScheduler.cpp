@@ -0,0 +1,113 @@
+// File/SaveScheduler.cpp - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SaveScheduler.cpp
+
+#include "SaveScheduler.h"
+#include "DataFile.h"
+#include "FileWriter.h"
+#include <QTimer>
+#include <QDebug>
+
+SaveScheduler *SaveScheduler::instance() {
+  static SaveScheduler *ss = new SaveScheduler();
+  return ss;
+}
+
+SaveScheduler::SaveScheduler() {
+  delay_s = 5; // save every 5 s
+  logging = false;
+  timer = new QTimer(this);
+  timer->setSingleShot(true);
+  connect(timer, SIGNAL(timeout()), SLOT(saveNow()));
+  connect(FileWriter::instance(), SIGNAL(written(int, bool)),
+          SLOT(writeDone(int)));
+}
+
+SaveScheduler::~SaveScheduler() {
+}
+
+void SaveScheduler::setDelay(double t_s) {
+  delay_s = t_s;
+}
+
+void SaveScheduler::setLogging(bool l) {
+  logging = l;
+}
+
+void SaveScheduler::schedule(DataFile0 *df) {
+  if (!pending.contains(df))
+    pending << df;
+  if (!timer->isActive())
+    timer->start(int(delay_s * 1e3));
+}
+
+void SaveScheduler::scheduleFlush(QObject *obj) {
+  if (!flushers.contains(obj))
+    flushers << obj;
+  if (!timer->isActive())
+    timer->start(int(delay_s * 1e3));
+}
+
+void SaveScheduler::saveNow() {
+  timer->stop();
+  QList< QPointer<DataFile0> > files = pending;
+  QList< QPointer<QObject> > objs = flushers;
+  pending.clear();
+  flushers.clear();
+
+  FileWriter *fw = FileWriter::instance();
+  Cycle c;
+  c.clock.start();
+  int firstWrite = fw->lastId();
+  qint64 bytes0 = fw->bytesQueued();
+  c.nfiles = 0;
+
+  for (int late=0; late<2; late++) {
+    foreach (DataFile0 *df, files) {
+      if (df && df->isSavedLast()==bool(late) && df->needToSave()) {
+        df->scheduledSave();
+        c.nfiles++;
+      }
+    }
+  }
+  foreach (QObject *obj, objs)
+    if (obj)
+      QMetaObject::invokeMethod(obj, "flush");
+
+  c.bytes = fw->bytesQueued() - bytes0;
+  c.lastWrite = fw->lastId();
+  if (c.lastWrite==firstWrite) {
+    if (c.nfiles)
+      report(c.nfiles, c.bytes, c.clock.elapsed()); // blocked, probably
+  } else {
+    cycles << c;
+  }
+}
+
+void SaveScheduler::writeDone(int id) {
+  while (!cycles.isEmpty() && cycles.first().lastWrite<=id) {
+    Cycle c = cycles.takeFirst();
+    report(c.nfiles, c.bytes, c.clock.elapsed());
+  }
+}
+
+void SaveScheduler::report(int nfiles, qint64 bytes, int ms) {
+  if (logging)
+    qDebug() << "SaveScheduler: saved" << nfiles << "files," << bytes
+             << "bytes in" << ms << "ms";
+  emit cycleCompleted(nfiles, bytes, ms);
+}
@@ -0,0 +1,71 @@
+// File/SaveScheduler.H - This file is part of eln
+
+/* eln is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   eln is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with eln.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// SaveScheduler.H
+
+#ifndef SAVESCHEDULER_H
+
+#define SAVESCHEDULER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QList>
+#include <QElapsedTimer>
+
+class SaveScheduler: public QObject {
+  /* SaveScheduler collects all DataFiles that need saving and saves
+     them together in one cycle, a few seconds after the first one asks.
+     Within a cycle, files marked with DataFile0::setSavedLast() come
+     after the others, and objects registered with scheduleFlush() have
+     their flush() slot called at the very end. When all writes of a
+     cycle have completed, cycleCompleted() reports on it.
+  */
+  Q_OBJECT;
+public:
+  static SaveScheduler *instance();
+  void schedule(class DataFile0 *);
+  void scheduleFlush(QObject *);
+  /* OBJ must have a flush() slot. */
+  void setDelay(double t_s);
+  void setLogging(bool);
+  /* If set, every cycle is also reported through qDebug(). */
+public slots:
+  void saveNow();
+  /* Runs a cycle immediately. */
+signals:
+  void cycleCompleted(int nfiles, qint64 bytes, int ms);
+private slots:
+  void writeDone(int id);
+private:
+  SaveScheduler();
+  virtual ~SaveScheduler();
+  void report(int nfiles, qint64 bytes, int ms);
+private:
+  struct Cycle {
+    int lastWrite;
+    int nfiles;
+    qint64 bytes;
+    QElapsedTimer clock;
+  };
+  class QTimer *timer;
+  double delay_s;
+  bool logging;
+  QList< QPointer<DataFile0> > pending;
+  QList< QPointer<QObject> > flushers;
+  QList<Cycle> cycles; // cycles whose writes have not all completed
+};
+
+#endif
@@ -310,7 +310,10 @@ void PageView::keyPressEvent(QKeyEvent *e) {
       take = false;
     break;
   case Qt::Key_F:
-    if (e->modifiers() & Qt::ControlModifier)
+    if ((e->modifiers() & Qt::ControlModifier)
+        && (e->modifiers() & Qt::ShiftModifier))
+      openLiveFindDialog();
+    else if (e->modifiers() & Qt::ControlModifier)
       openFindDialog();
     else
       take = false;
@@ -538,6 +541,7 @@ void PageView::leavePage() {
 	QList<QGraphicsView *> allv = entryScene->allViews();
 	if (allv.size()==1 && allv.first() == this) {
 	  entryScene.clear();
+	  bank->dropEntryScene(currentPage);
 	  book->deleteEntry(currentPage);
 	  return;
 	}
@@ -775,6 +779,10 @@ void PageView::openFindDialog() {
   searchDialog->newSearch();
 }
 
+void PageView::openLiveFindDialog() {
+  searchDialog->newLiveSearch();
+}
+
 void PageView::openGotoPageDialog() {
   int N = book->toc()->newPageNumber();
   int n = GotoPageDialog::exec(this, N-1);
@@ -71,6 +71,7 @@ public slots:
   void lastPage(Qt::KeyboardModifiers m=0);
   void newPage(Qt::KeyboardModifiers m=0);
   void openFindDialog();
+  void openLiveFindDialog();
   void openGotoPageDialog();
   void htmlDialog();
   void drop(QDropEvent);
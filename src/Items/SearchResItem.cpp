@@ -106,6 +106,20 @@ int SearchResItem::decentBreak(QString s, int first, int last) {
 
 void SearchResItem::fillText(QTextDocument *doc, SearchResult const &res) {
   doc->clear();
+  if (res.whereInContext.isEmpty()) {
+    // Found by metadata only: show the beginning
+    int postbreak = decentBreak(res.context, 80, 120);
+    if (postbreak<0 && res.context.size()>120)
+      postbreak = 120;
+    QTextCursor c(doc);
+    if (postbreak<0) {
+      c.insertText(res.context);
+    } else {
+      c.insertText(res.context.left(postbreak));
+      c.insertText(QString::fromUtf8(" …"));
+    }
+    return;
+  }
   bool nextpredone = false;
   for (int k=0; k<res.whereInContext.size(); k++) {
     int strt = res.whereInContext[k];
@@ -39,6 +39,7 @@
 #include "PageView.h"
 #include "Unicode.h"
 #include "OneLink.h"
+#include "PhraseMatcher.h"
 
 #include <math.h>
 #include <QPainter>
@@ -369,10 +370,12 @@ void TextItem::representSearchPhrase(QList<TransientMarkup> &tmm) const {
   QString phr = SearchDialog::latestPhrase();
   if (phr.isEmpty())
     return;
+  static PhraseMatcher matcher;
+  if (matcher.phrase()!=phr)
+    matcher = PhraseMatcher(phr); // we get painted often, the phrase rarely changes
   QString txt = text->text();
-  int N = phr.length();
-  for (int off=txt.indexOf(phr, 0, Qt::CaseInsensitive); off>=0;
-       off=txt.indexOf(phr, off+N, Qt::CaseInsensitive)) 
+  int N = matcher.size();
+  for (int off=matcher.indexIn(txt); off>=0; off=matcher.indexIn(txt, off+N))
     tmm << TransientMarkup(off, off+N, MarkupData::SearchResult);
 }
 
@@ -32,6 +32,7 @@
 #include "TableData.h"
 #include "ElnAssert.h"
 #include "Unicode.h"
+#include "PhraseMatcher.h"
 
 TextItemDoc *TextItemDoc::create(TextData *data, QObject *parent) {
   TableData *tabledata = dynamic_cast<TableData *>(data);
@@ -743,7 +744,7 @@ QChar TextItemDoc::characterAt(int pos) const {
 }
 
 int TextItemDoc::find(QString s) const {
-  return text().indexOf(s, firstPosition(), Qt::CaseInsensitive);
+  return PhraseMatcher(s).indexIn(text(), firstPosition());
 }
 
 void TextItemDoc::makeWritable() {
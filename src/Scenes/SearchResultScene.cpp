@@ -48,12 +48,22 @@ void SearchResultScene::update(QList<SearchResult> res) {
   populate();
 }
 
+void SearchResultScene::setPhrase(QString p, QString t) {
+  phrase = p;
+  ttl = t;
+  foreach (SheetScene *s, sheets)
+    s->setTitle(ttl);
+}
+
 void SearchResultScene::populate() {
   BaseScene::populate();
   foreach (TOCItem *i, headers)
     delete i;
   headers.clear();
   sheetnos.clear();
+  foreach (QGraphicsItem *i, continuations)
+    delete i;
+  continuations.clear(); // else repeated update() calls would stack them
 
   int oldPage = -1;
 
@@ -98,7 +108,7 @@ void SearchResultScene::populate() {
       y = y0 + headers.last()->childrenBoundingRect().height();
     }
   }
-  nSheets = sheet+1;
+  setSheetCount(sheet+1); // drops sheets left over from earlier results
 }
 
 void SearchResultScene::createContinuationItem(int i, double ytop, double ybot) {
@@ -108,6 +118,7 @@ void SearchResultScene::createContinuationItem(int i, double ytop, double ybot)
   item->setFont(f);
   item->setDefaultTextColor(style().color("latenote-text-color"));
   this->sheet(i, true)->addItem(item);
+  continuations << item;
   double x0 = style().real("margin-left");
   double w0 = style().real("page-width") - style().real("margin-right")
     - style().real("margin-left");
@@ -30,6 +30,8 @@ public:
                     Data *data, QObject *parent=0);
   virtual ~SearchResultScene();
   void update(QList<SearchResult> results);
+  void setPhrase(QString phrase, QString title);
+  /* For live searching. Call update() after this. */
   virtual void populate();
   virtual QString title() const;
 public slots:
@@ -52,6 +54,7 @@ private:
   QList<SearchResult> results;
   QList<class SearchResItem *> headers; // one for each entry with a result
   QList<int> sheetnos; // one for each header; sheet in this scene
+  QList<class QGraphicsItem *> continuations;
   static QSet<SearchResultScene const *> &allInstances();
 };
 